@@ -0,0 +1,267 @@
+/* * NSET v6.0 - Token Arena
+ * -------------------------------------------------------
+ * The token record and the per-worker container tokens are emitted
+ * into. Storage is a table of fixed-size chunks (ARENA_CHUNK_TOKENS
+ * each) mapped on demand, so a file only costs the chunks its tokens
+ * fill, the arena never runs out of room, and growing never moves the
+ * tokens already emitted. arena_reset() keeps every chunk, so a worker
+ * maps memory only while it meets a file bigger than any before; the
+ * high-water mark says how far that went.
+ * With `huge`, chunks are mapped with MAP_HUGETLB when the system has
+ * huge pages reserved, and otherwise marked MADV_HUGEPAGE for
+ * transparent huge pages.
+ * Tokens are read by value (arena_get) and only their meta is written
+ * in place (arena_meta), so callers never hold pointers into a chunk
+ * and the same calls work for either chunk layout (see ArenaChunk).
+ */
+
+#ifndef NSET_ARENA_H
+#define NSET_ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+// Note: This differs slightly from core.h because we need 'offset'
+// for runtime tracking within the memory-mapped file.
+typedef struct {
+    uint16_t type       : 3;
+    uint16_t casing     : 2;
+    uint16_t pre_space  : 1;
+    uint16_t pre_break  : 1;
+    uint16_t has_joiner : 1;
+    uint16_t depth      : 3;
+    uint16_t absorbed   : 4;  // ABSORB_*: symbol folded into this token
+    uint16_t spare      : 1;
+} NSET_Meta;
+
+// Symbols a token can absorb (the one right after it, see lookahead.h).
+// Stored in NSET_Meta.absorbed; append-only, the value is the code.
+enum {
+    ABSORB_NONE,
+    ABSORB_SEMI, ABSORB_COMMA, ABSORB_PAREN, ABSORB_CLOSE, ABSORB_STAR,
+    ABSORB_BRACE, ABSORB_CLOSE_BRACE, ABSORB_BRACKET, ABSORB_CLOSE_BRACKET,
+    ABSORB_DOT, ABSORB_ARROW,
+    ABSORB_COUNT
+};
+
+typedef struct {
+    uint32_t root_id;
+    uint32_t offset;
+    uint16_t length;
+    NSET_Meta meta;
+} NSET_Token;
+
+#define ARENA_CHUNK_SHIFT  17
+#define ARENA_CHUNK_TOKENS ((size_t)1 << ARENA_CHUNK_SHIFT)
+#define ARENA_CHUNK_MASK   (ARENA_CHUNK_TOKENS - 1)
+#define ARENA_HUGE_PAGE    ((size_t)2 << 20)
+
+// Chunk layout, chosen at compile time (make ARENA=soa):
+// - default: an array of NSET_Token records
+// - NSET_ARENA_SOA: one column per field (root_id, offset, length,
+//   meta), so passes that need one field stream just that column
+#ifdef NSET_ARENA_SOA
+#define ARENA_LAYOUT "columns"
+#else
+#define ARENA_LAYOUT "records"
+#endif
+
+typedef struct {
+    void *base;           // The chunk's mapping
+    size_t bytes;         // Mapped size
+#ifdef NSET_ARENA_SOA
+    uint32_t *root_id;
+    uint32_t *offset;
+    uint16_t *length;
+    NSET_Meta *meta;
+#else
+    NSET_Token *tokens;
+#endif
+} ArenaChunk;
+
+typedef struct {
+    ArenaChunk *chunks;   // Kept across resets
+    size_t n_chunks, cap_chunks;
+    size_t count;
+    size_t high_water;    // Most tokens held at once
+    size_t huge_chunks;   // Chunks backed by MAP_HUGETLB
+    bool huge;
+    // Scratch for the layout a caller asks for but the chunks do not
+    // hold; allocated on first use
+    NSET_Token *records;
+    uint32_t *root_ids;
+} Arena;
+
+static inline void arena_init(Arena *a, bool huge) {
+    a->chunks = NULL;
+    a->n_chunks = a->cap_chunks = 0;
+    a->count = a->high_water = a->huge_chunks = 0;
+    a->huge = huge;
+    a->records = NULL;
+    a->root_ids = NULL;
+}
+
+static inline void arena_grow(Arena *a) {
+    if (a->n_chunks == a->cap_chunks) {
+        a->cap_chunks = a->cap_chunks ? a->cap_chunks * 2 : 8;
+        a->chunks = realloc(a->chunks, a->cap_chunks * sizeof(ArenaChunk));
+    }
+    size_t bytes = ARENA_CHUNK_TOKENS * sizeof(NSET_Token);
+    void *p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (a->huge) {
+        size_t huge_bytes = (bytes + ARENA_HUGE_PAGE - 1) & ~(ARENA_HUGE_PAGE - 1);
+        p = mmap(NULL, huge_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) { bytes = huge_bytes; a->huge_chunks++; }
+    }
+#endif
+    if (p == MAP_FAILED) {
+        p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            fprintf(stderr, "Error: out of memory for %lu tokens\n", (unsigned long)(a->count + 1));
+            exit(1);
+        }
+#ifdef MADV_HUGEPAGE
+        if (a->huge) madvise(p, bytes, MADV_HUGEPAGE);
+#endif
+    }
+    ArenaChunk c = { .base = p, .bytes = bytes };
+#ifdef NSET_ARENA_SOA
+    // Widest column first keeps every column aligned
+    c.root_id = p;
+    c.offset = c.root_id + ARENA_CHUNK_TOKENS;
+    c.length = (uint16_t *)(c.offset + ARENA_CHUNK_TOKENS);
+    c.meta = (NSET_Meta *)(c.length + ARENA_CHUNK_TOKENS);
+#else
+    c.tokens = p;
+#endif
+    a->chunks[a->n_chunks++] = c;
+}
+
+static inline void arena_append(Arena *a, const NSET_Token *t) {
+    size_t c = a->count >> ARENA_CHUNK_SHIFT;
+    if (c == a->n_chunks) arena_grow(a);
+    size_t i = a->count & ARENA_CHUNK_MASK;
+#ifdef NSET_ARENA_SOA
+    ArenaChunk *ch = &a->chunks[c];
+    ch->root_id[i] = t->root_id;
+    ch->offset[i] = t->offset;
+    ch->length[i] = t->length;
+    ch->meta[i] = t->meta;
+#else
+    a->chunks[c].tokens[i] = *t;
+#endif
+    a->count++;
+}
+
+static inline NSET_Token arena_get(const Arena *a, size_t i) {
+    const ArenaChunk *ch = &a->chunks[i >> ARENA_CHUNK_SHIFT];
+    i &= ARENA_CHUNK_MASK;
+#ifdef NSET_ARENA_SOA
+    NSET_Token t = { ch->root_id[i], ch->offset[i], ch->length[i], ch->meta[i] };
+    return t;
+#else
+    return ch->tokens[i];
+#endif
+}
+
+static inline NSET_Meta *arena_meta(Arena *a, size_t i) {
+    ArenaChunk *ch = &a->chunks[i >> ARENA_CHUNK_SHIFT];
+#ifdef NSET_ARENA_SOA
+    return &ch->meta[i & ARENA_CHUNK_MASK];
+#else
+    return &ch->tokens[i & ARENA_CHUNK_MASK].meta;
+#endif
+}
+
+static inline size_t arena_chunks_used(const Arena *a) {
+    return (a->count + ARENA_CHUNK_MASK) >> ARENA_CHUNK_SHIFT;
+}
+
+static inline size_t arena_chunk_count(const Arena *a, size_t c) {
+    size_t first = c << ARENA_CHUNK_SHIFT;
+    return a->count - first < ARENA_CHUNK_TOKENS ? a->count - first : ARENA_CHUNK_TOKENS;
+}
+
+// Tokens of chunk `c` as NSET_Token records (*n of them). Zero-copy in
+// the default layout; gathered into scratch with NSET_ARENA_SOA.
+static inline const NSET_Token *arena_records(Arena *a, size_t c, size_t *n) {
+    *n = arena_chunk_count(a, c);
+#ifdef NSET_ARENA_SOA
+    if (!a->records) a->records = malloc(ARENA_CHUNK_TOKENS * sizeof(NSET_Token));
+    for (size_t i = 0; i < *n; i++) a->records[i] = arena_get(a, (c << ARENA_CHUNK_SHIFT) + i);
+    return a->records;
+#else
+    return a->chunks[c].tokens;
+#endif
+}
+
+// root_ids of chunk `c` as one contiguous column (*n of them). Zero-copy
+// with NSET_ARENA_SOA; gathered into scratch in the default layout.
+static inline const uint32_t *arena_root_ids(Arena *a, size_t c, size_t *n) {
+    *n = arena_chunk_count(a, c);
+#ifdef NSET_ARENA_SOA
+    return a->chunks[c].root_id;
+#else
+    if (!a->root_ids) a->root_ids = malloc(ARENA_CHUNK_TOKENS * sizeof(uint32_t));
+    const NSET_Token *t = a->chunks[c].tokens;
+    for (size_t i = 0; i < *n; i++) a->root_ids[i] = t[i].root_id;
+    return a->root_ids;
+#endif
+}
+
+// Tokens whose root_id is below `limit` (e.g. reserved ids): a column
+// scan the compiler vectorizes, or a strided one over records.
+static inline size_t arena_count_ids_below(const Arena *a, uint32_t limit) {
+    size_t total = 0;
+    for (size_t c = 0; c < arena_chunks_used(a); c++) {
+        size_t n = arena_chunk_count(a, c), below = 0;
+#ifdef NSET_ARENA_SOA
+        const uint32_t *ids = a->chunks[c].root_id;
+        for (size_t i = 0; i < n; i++) below += ids[i] < limit;
+#else
+        const NSET_Token *t = a->chunks[c].tokens;
+        for (size_t i = 0; i < n; i++) below += t[i].root_id < limit;
+#endif
+        total += below;
+    }
+    return total;
+}
+
+// Adds `delta` to every token's offset (e.g. where a stream segment starts).
+static inline void arena_shift(Arena *a, uint32_t delta) {
+    for (size_t c = 0; c < arena_chunks_used(a); c++) {
+        size_t n = arena_chunk_count(a, c);
+#ifdef NSET_ARENA_SOA
+        uint32_t *offset = a->chunks[c].offset;
+        for (size_t i = 0; i < n; i++) offset[i] += delta;
+#else
+        NSET_Token *t = a->chunks[c].tokens;
+        for (size_t i = 0; i < n; i++) t[i].offset += delta;
+#endif
+    }
+}
+
+// Empties the arena for the next file; the chunks stay mapped.
+static inline void arena_reset(Arena *a) {
+    if (a->count > a->high_water) a->high_water = a->count;
+    a->count = 0;
+}
+
+static inline void arena_free(Arena *a) {
+    arena_reset(a);
+    for (size_t c = 0; c < a->n_chunks; c++) munmap(a->chunks[c].base, a->chunks[c].bytes);
+    free(a->chunks);
+    free(a->records);
+    free(a->root_ids);
+    a->chunks = NULL;
+    a->records = NULL;
+    a->root_ids = NULL;
+    a->n_chunks = a->cap_chunks = 0;
+}
+
+#endif
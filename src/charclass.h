@@ -0,0 +1,54 @@
+/* * NSET v6.0 - Character Classes
+ * -------------------------------------------------------
+ * Byte classification for the tokenizer hot loops.
+ * - One 256-entry class table and one lowercase table, both built by
+ *   the compiler from constant expressions (no init step, no libc).
+ * - Semantics are those of the "C" locale: bytes >= 0x80 belong to no
+ *   class and lowercase to themselves, whatever LC_CTYPE says.
+ * Every call takes the byte as uint8_t, so signed `char` input is safe.
+ */
+
+#ifndef NSET_CHARCLASS_H
+#define NSET_CHARCLASS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CC_UPPER  0x01
+#define CC_LOWER  0x02
+#define CC_DIGIT  0x04
+#define CC_SPACE  0x08   // ' ' \t \n \v \f \r
+#define CC_PUNCT  0x10   // Printable, not alnum, not space
+#define CC_IDENT  0x20   // [A-Za-z0-9_]
+
+#define CC_IN(c, lo, hi) ((c) >= (lo) && (c) <= (hi))
+#define CC_CLASS_OF(c) ( \
+    (CC_IN(c, 'A', 'Z') ? CC_UPPER | CC_IDENT : 0) | \
+    (CC_IN(c, 'a', 'z') ? CC_LOWER | CC_IDENT : 0) | \
+    (CC_IN(c, '0', '9') ? CC_DIGIT | CC_IDENT : 0) | \
+    ((c) == '_' ? CC_IDENT : 0) | \
+    ((c) == ' ' || CC_IN(c, '\t', '\r') ? CC_SPACE : 0) | \
+    (CC_IN(c, 0x21, 0x2F) || CC_IN(c, 0x3A, 0x40) || \
+     CC_IN(c, 0x5B, 0x60) || CC_IN(c, 0x7B, 0x7E) ? CC_PUNCT : 0))
+#define CC_LOWER_OF(c) (CC_IN(c, 'A', 'Z') ? (c) + ('a' - 'A') : (c))
+
+#define CC_ROW(F, b) \
+    F((b)+0x0), F((b)+0x1), F((b)+0x2), F((b)+0x3), F((b)+0x4), F((b)+0x5), F((b)+0x6), F((b)+0x7), \
+    F((b)+0x8), F((b)+0x9), F((b)+0xA), F((b)+0xB), F((b)+0xC), F((b)+0xD), F((b)+0xE), F((b)+0xF)
+#define CC_TABLE(F) \
+    CC_ROW(F, 0x00), CC_ROW(F, 0x10), CC_ROW(F, 0x20), CC_ROW(F, 0x30), \
+    CC_ROW(F, 0x40), CC_ROW(F, 0x50), CC_ROW(F, 0x60), CC_ROW(F, 0x70), \
+    CC_ROW(F, 0x80), CC_ROW(F, 0x90), CC_ROW(F, 0xA0), CC_ROW(F, 0xB0), \
+    CC_ROW(F, 0xC0), CC_ROW(F, 0xD0), CC_ROW(F, 0xE0), CC_ROW(F, 0xF0)
+
+static const uint8_t CC_CLASS[256] = { CC_TABLE(CC_CLASS_OF) };
+static const uint8_t CC_LOWERCASE[256] = { CC_TABLE(CC_LOWER_OF) };
+
+static inline bool cc_is(uint8_t c, uint8_t classes) { return (CC_CLASS[c] & classes) != 0; }
+static inline bool cc_is_upper(uint8_t c) { return CC_CLASS[c] & CC_UPPER; }
+static inline bool cc_is_lower(uint8_t c) { return CC_CLASS[c] & CC_LOWER; }
+static inline bool cc_is_digit(uint8_t c) { return CC_CLASS[c] & CC_DIGIT; }
+static inline bool cc_is_space(uint8_t c) { return CC_CLASS[c] & CC_SPACE; }
+static inline uint8_t cc_lower(uint8_t c) { return CC_LOWERCASE[c]; }
+
+#endif
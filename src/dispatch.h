@@ -0,0 +1,97 @@
+/* * NSET v6.0 - Node Dispatch
+ * -------------------------------------------------------
+ * Maps every grammar symbol to the handler class the traversal uses,
+ * so a leaf is classified with one ts_node_symbol() load and a table
+ * read instead of string compares on ts_node_type().
+ * The table is built once per language from the symbol names, with
+ * exactly the rules the string checks used:
+ *   name contains "identifier"        -> NODE_IDENTIFIER
+ *   "comment" / "string_literal"      -> NODE_COMMENT / NODE_STRING
+ *   name starts with "preproc"        -> NODE_PREPROC
+ *   anything else                     -> NODE_OTHER
+ * Aliased nodes report their alias symbol, whose name is the alias, so
+ * they classify the same way ts_node_type() did.
+ *
+ * The table also carries each symbol's reserved id (reserved.h).
+ * Anonymous symbols (keywords, directives, operators) always spell the
+ * same token, so their id is resolved here once. The few named leaves
+ * whose text varies (primitive_type, true, false, null) are marked
+ * RESERVED_BY_TEXT and looked up by their text.
+ */
+
+#ifndef NSET_DISPATCH_H
+#define NSET_DISPATCH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tree_sitter/api.h>
+
+#include "reserved.h"
+
+typedef enum {
+    NODE_OTHER = 0,
+    NODE_IDENTIFIER,
+    NODE_COMMENT,
+    NODE_STRING,
+    NODE_PREPROC
+} NodeClass;
+
+#define RESERVED_BY_TEXT 0xFFFF
+
+typedef struct {
+    uint8_t *classes;     // Indexed by TSSymbol
+    uint16_t *reserved;   // Indexed by TSSymbol; 0 = hashed token
+    uint32_t count;
+} NodeDispatch;
+
+static inline NodeClass dispatch_classify_name(const char *name) {
+    if (!name) return NODE_OTHER;
+    if (strstr(name, "identifier")) return NODE_IDENTIFIER;
+    if (strcmp(name, "comment") == 0) return NODE_COMMENT;
+    if (strcmp(name, "string_literal") == 0) return NODE_STRING;
+    if (strncmp(name, "preproc", 7) == 0) return NODE_PREPROC;
+    return NODE_OTHER;
+}
+
+static inline uint16_t dispatch_reserved_name(const TSLanguage *lang, TSSymbol s) {
+    const char *name = ts_language_symbol_name(lang, s);
+    if (!name) return 0;
+    if (ts_language_symbol_type(lang, s) == TSSymbolTypeAnonymous)
+        return reserved_lookup(name, strlen(name));
+    if (strcmp(name, "primitive_type") == 0 || strcmp(name, "true") == 0 ||
+        strcmp(name, "false") == 0 || strcmp(name, "null") == 0)
+        return RESERVED_BY_TEXT;
+    return 0;
+}
+
+static inline void dispatch_init(NodeDispatch *d, const TSLanguage *lang) {
+    reserved_init();
+    d->count = ts_language_symbol_count(lang);
+    d->classes = calloc(d->count ? d->count : 1, 1);
+    d->reserved = calloc(d->count ? d->count : 1, sizeof(uint16_t));
+    for (uint32_t s = 0; s < d->count; s++) {
+        d->classes[s] = dispatch_classify_name(ts_language_symbol_name(lang, (TSSymbol)s));
+        d->reserved[s] = dispatch_reserved_name(lang, (TSSymbol)s);
+    }
+}
+
+static inline NodeClass dispatch_class(const NodeDispatch *d, TSSymbol s) {
+    return s < d->count ? (NodeClass)d->classes[s] : NODE_OTHER;
+}
+
+// Reserved id of a leaf, 0 if it is an ordinary hashed token.
+static inline uint16_t dispatch_reserved(const NodeDispatch *d, TSSymbol s, const char *text, int len) {
+    uint16_t id = s < d->count ? d->reserved[s] : 0;
+    return id == RESERVED_BY_TEXT ? reserved_lookup(text, len) : id;
+}
+
+static inline void dispatch_free(NodeDispatch *d) {
+    free(d->classes);
+    free(d->reserved);
+    d->classes = NULL;
+    d->reserved = NULL;
+    d->count = 0;
+}
+
+#endif
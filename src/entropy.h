@@ -2,44 +2,176 @@
 #define NSET_ENTROPY_H
 
 #include <math.h>
-#include <ctype.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <string.h>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
 // A lightweight Bigram Model (64KB memory)
 // It tracks: "How often does character B follow character A?"
 typedef struct {
     uint32_t counts[256][256];
     uint32_t totals[256];
+    // Bumped whenever a split decision in that row flips (see model_split_test),
+    // so caches of split results can tell when they went stale.
+    uint32_t row_epoch[256];
+    // Bit `next` of row `cur` caches model_split_test() for that pair (8KB,
+    // stays in L1), kept current by model_train_sequence.
+    uint64_t split_bits[256][4];
+    uint64_t generation;    // Unique per model instance/copy
 } EntropyModel;
 
+// counts and totals form one flat array of u32 counters (merged as such)
+#define MODEL_COUNTERS (256 * 256 + 256)
+_Static_assert(MODEL_COUNTERS % 32 == 0, "merge works in 32-counter steps");
+_Static_assert(offsetof(EntropyModel, counts) == 0 &&
+               offsetof(EntropyModel, totals) == sizeof(uint32_t) * 256 * 256, "counters must lead the model");
+
+// Split decision of the main engine: surprise -log2(p) > 5.0, i.e.
+// p = (c + 0.1) / (t + 1) < 2^-5, in exact integer form: t >= 32c + 3.
+static inline bool model_split_test(uint32_t count, uint32_t total) {
+    return total >= 5 && total >= 32 * (uint64_t)count + 3;
+}
+
+static inline bool model_should_split(const EntropyModel *m, uint8_t cur, uint8_t next) {
+    return (m->split_bits[cur][next >> 6] >> (next & 63)) & 1;
+}
+
+// Re-derives one decision bit. Returns true if it flipped.
+static inline bool model_update_bit(EntropyModel *m, uint8_t cur, uint8_t next) {
+    uint64_t *word = &m->split_bits[cur][next >> 6];
+    uint64_t bit = 1ull << (next & 63);
+    uint64_t now = model_split_test(m->counts[cur][next], m->totals[cur]) ? bit : 0;
+    bool flipped = (*word & bit) != now;
+    *word = (*word & ~bit) | now;
+    return flipped;
+}
+
+// Re-derives a whole row: with total t the test is count <= (t - 3) / 32.
+// Returns true if any bit flipped.
+static inline bool model_refresh_row(EntropyModel *m, uint8_t cur) {
+    uint32_t t = m->totals[cur];
+    bool flipped = false;
+    for (int w = 0; w < 4; w++) {
+        uint64_t bits = 0;
+        if (t >= 5) {
+            uint32_t limit = (t - 3) / 32;
+            for (int b = 0; b < 64; b++)
+                bits |= (uint64_t)(m->counts[cur][w * 64 + b] <= limit) << b;
+        }
+        flipped |= (bits != m->split_bits[cur][w]);
+        m->split_bits[cur][w] = bits;
+    }
+    return flipped;
+}
+
+// Copies a model and gives the copy a fresh generation.
+static inline void model_copy(EntropyModel *dst, const EntropyModel *src) {
+    static _Atomic uint64_t next_generation = 1;
+    memcpy(dst, src, sizeof(EntropyModel));
+    dst->generation = atomic_fetch_add(&next_generation, 1);
+}
+
+// Counts-only training for corpus passes: no decision bits, no epochs.
+// Shards trained this way are merged and then model_rebuild() once.
+static inline void model_count_sequence(EntropyModel *m, const char *text, int len) {
+    for (int i = 0; i < len - 1; i++) {
+        uint8_t cur = (uint8_t)text[i];
+        m->counts[cur][(uint8_t)text[i+1]]++;
+        m->totals[cur]++;
+    }
+}
+
 // 1. TEACH the model (Online Learning)
 static inline void model_train_sequence(EntropyModel *m, const char *text, int len) {
     if (len < 2) return;
     for (int i = 0; i < len - 1; i++) {
         uint8_t cur = (uint8_t)text[i];
         uint8_t next = (uint8_t)text[i+1];
-        m->counts[cur][next]++;
-        m->totals[cur]++;
+        uint32_t c = m->counts[cur][next];
+        uint32_t t = m->totals[cur];
+        m->counts[cur][next] = c + 1;
+        m->totals[cur] = t + 1;
+
+        // Did any decision in this row flip? The trained pair can; the other
+        // followers only when the new total reaches 5 or 32k + 3.
+        bool flipped;
+        if (t + 1 == 5 || (t + 1 > 5 && (t + 1 - 3) % 32 == 0)) flipped = model_refresh_row(m, cur);
+        else flipped = model_update_bit(m, cur, next);
+        if (flipped) m->row_epoch[cur]++;
     }
 }
 
 // 2. QUERY the model (Rényi Entropy)
-// Returns a "Surprise Score" (0.0 to ~10.0)
+// log2 of a positive integer from its exponent (clz) plus a 1024-entry
+// mantissa table; error is below 0.0015 bits. Shared by every model.
+#define MODEL_LOG2_BITS 10
+static float model_log2_mant[(1 << MODEL_LOG2_BITS) + 1];
+static pthread_once_t model_log2_once = PTHREAD_ONCE_INIT;
+
+static void model_log2_init() {
+    for (int i = 0; i <= (1 << MODEL_LOG2_BITS); i++)
+        model_log2_mant[i] = log2f(1.0f + (float)i / (1 << MODEL_LOG2_BITS));
+}
+
+static inline float model_log2q(uint64_t x) {
+    int e = 63 - __builtin_clzll(x);
+    uint64_t mant = (e >= MODEL_LOG2_BITS) ? (x >> (e - MODEL_LOG2_BITS)) : (x << (MODEL_LOG2_BITS - e));
+    return (float)e + model_log2_mant[mant & ((1u << MODEL_LOG2_BITS) - 1)];
+}
+
+// Returns a "Surprise Score" (0.0 to ~10.0). Split decisions use
+// model_should_split(); this is for reporting and analysis.
 static inline float calculate_surprise(EntropyModel *m, uint8_t cur, uint8_t next) {
     // If we haven't seen 'cur' enough times, we can't judge. Default to "No Surprise".
     if (m->totals[cur] < 5) return 0.0f; 
+    pthread_once(&model_log2_once, model_log2_init);
 
-    float count = (float)m->counts[cur][next];
-    float total = (float)m->totals[cur];
-    
-    // Probability P(next | cur)
-    // We add mild smoothing (+0.1) to avoid division by zero errors
-    float p = (count + 0.1f) / (total + 1.0f);
+    // P(next | cur) with mild smoothing: (count + 0.1) / (total + 1), so
+    // -log2(p) = log2(total + 1) - log2(10 * count + 1) + log2(10).
+    // Rényi Entropy (alpha=2) is -log(p^2); -log(p) acts as the "Surprise" metric.
+    return model_log2q((uint64_t)m->totals[cur] + 1) - model_log2q(10ull * m->counts[cur][next] + 1) + 3.321928f;
+}
+
+// 3. COMBINE models (corpus training)
+// Adds what `trained` learned since it was copied from `base` into `acc`.
+static inline void model_accumulate(EntropyModel *acc, const EntropyModel *trained, const EntropyModel *base) {
+    for (int c = 0; c < 256; c++) {
+        if (trained->totals[c] == base->totals[c]) continue; // Row untouched
+        for (int n = 0; n < 256; n++) acc->counts[c][n] += trained->counts[c][n] - base->counts[c][n];
+        acc->totals[c] += trained->totals[c] - base->totals[c];
+    }
+}
+
+// Adds the counts of `src` into `dst` (8 counters per AVX2 step).
+// Call model_rebuild() once done.
+static inline void model_merge(EntropyModel *dst, const EntropyModel *src) {
+    uint32_t *d = (uint32_t *)(void *)dst;
+    const uint32_t *s = (const uint32_t *)(const void *)src;
+#if defined(__AVX2__)
+    for (size_t i = 0; i < MODEL_COUNTERS; i += 32) {
+        for (int k = 0; k < 32; k += 8) {
+            __m256i a = _mm256_loadu_si256((const __m256i *)(d + i + k));
+            __m256i b = _mm256_loadu_si256((const __m256i *)(s + i + k));
+            _mm256_storeu_si256((__m256i *)(d + i + k), _mm256_add_epi32(a, b));
+        }
+    }
+#else
+    for (size_t i = 0; i < MODEL_COUNTERS; i++) d[i] += s[i];
+#endif
+}
 
-    // Rényi Entropy (alpha=2) is -log(p^2)
-    // We simplify to -log(p) * 2 for speed, which acts as a "Surprise" metric.
-    return -log2f(p);
+// Re-derives the decision bitset from the counts and resets the epochs.
+static inline void model_rebuild(EntropyModel *m) {
+    for (int c = 0; c < 256; c++) model_refresh_row(m, c);
+    memset(m->row_epoch, 0, sizeof(m->row_epoch));
+    m->generation = 0;
 }
 
 #endif
@@ -11,7 +11,6 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
-#include <ctype.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -20,6 +19,9 @@
 
 // Import shared logic from parent directory
 #include "../entropy.h"
+#include "../charclass.h"
+#include "../locked.h"
+#include "../dispatch.h"
 
 // ==========================================
 // 1. DATA STRUCTURES (Meta-Heavy)
@@ -66,17 +68,11 @@ const char *LOCKED_VOCAB[] = {
     "count", "offset", "data", "node", "tree", "parser", "cursor", "root"
 };
 
-int vocab_cmp(const void *a, const void *b) {
-    return strcmp((const char*)a, *(const char**)b);
-}
+LockedSet locked_words = {0};   // Perfect hash over LOCKED_VOCAB (see locked.h)
+NodeDispatch node_dispatch = {0};  // Leaf class per grammar symbol (see dispatch.h)
 
 bool is_word_locked(const char *str, int len) {
-    char buffer[64];
-    if (len >= 64) return false;
-    for(int i=0; i<len; i++) buffer[i] = tolower(str[i]);
-    buffer[len] = '\0';
-    const char *key = buffer;
-    return bsearch(key, LOCKED_VOCAB, sizeof(LOCKED_VOCAB)/sizeof(char*), sizeof(char*), vocab_cmp) != NULL;
+    return locked_contains(&locked_words, str, len);
 }
 
 // ==========================================
@@ -88,16 +84,16 @@ EntropyModel global_model = {0};
 
 uint32_t murmur_hash(const char *key, int len) {
     uint32_t h = 0x811c9dc5;
-    for (int i=0; i<len; i++) { h ^= (uint8_t)tolower(key[i]); h *= 0x01000193; }
+    for (int i=0; i<len; i++) { h ^= cc_lower(key[i]); h *= 0x01000193; }
     return h;
 }
 
 uint8_t get_casing(const char *s, int len) {
     int caps=0;
-    for(int i=0; i<len; i++) if(isupper(s[i])) caps++;
+    for(int i=0; i<len; i++) if(cc_is_upper(s[i])) caps++;
     if(caps==0) return 0;
     if(caps==len) return 2;
-    if(caps==1 && isupper(s[0])) return 1;
+    if(caps==1 && cc_is_upper(s[0])) return 1;
     return 3;
 }
 
@@ -110,7 +106,7 @@ void arena_push(Arena *a, NSET_Token t, const char *code, size_t total_size) {
     uint32_t next_pos = t.offset + t.length;
     
     // Skip spaces to find the next meaningful char
-    while (next_pos < total_size && isspace(code[next_pos])) {
+    while (next_pos < total_size && cc_is_space(code[next_pos])) {
         next_pos++;
     }
 
@@ -144,7 +140,6 @@ void process_identifier(Arena *arena, const char *src, int offset, int len, int
 
     model_train_sequence(&global_model, src + offset, len);
     int start = 0;
-    float entropy_threshold = 5.0f; 
     int tokens_emitted = 0;
 
     for (int i = 0; i < len; i++) {
@@ -173,9 +168,9 @@ void process_identifier(Arena *arena, const char *src, int offset, int len, int
             bool split = false;
             
             // CamelCase
-            if (islower(cur) && isupper(next)) split = true;
-            // Entropy (Using shared calculate_surprise)
-            else if (calculate_surprise(&global_model, cur, next) > entropy_threshold) {
+            if (cc_is_lower(cur) && cc_is_upper(next)) split = true;
+            // Entropy (shared split table: surprise > 5.0)
+            else if (model_should_split(&global_model, cur, next)) {
                 int left_len = (i + 1) - start;
                 int right_len = len - (i + 1);
                 if (is_word_locked(src + offset + start, left_len)) split = true;
@@ -219,6 +214,9 @@ int main(int argc, char **argv) {
     int vocab_size = sizeof(LOCKED_VOCAB)/sizeof(char*);
     for(int n=0; n<20; n++) for(int i=0; i<vocab_size; i++) 
         model_train_sequence(&global_model, LOCKED_VOCAB[i], strlen(LOCKED_VOCAB[i]));
+    for(int i=0; i<vocab_size; i++) locked_add(&locked_words, LOCKED_VOCAB[i], strlen(LOCKED_VOCAB[i]));
+    locked_build(&locked_words);
+    dispatch_init(&node_dispatch, tree_sitter_c());
 
     int fd = open(argv[1], O_RDONLY);
     struct stat sb; fstat(fd, &sb);
@@ -243,8 +241,8 @@ int main(int argc, char **argv) {
             uint32_t start = ts_node_start_byte(node);
             uint32_t end = ts_node_end_byte(node);
             uint16_t len = end - start;
-            const char *type = ts_node_type(node);
-            bool pre_space = (start > 0 && isspace(code[start-1]) && code[start-1]!='\n');
+            NodeClass cls = dispatch_class(&node_dispatch, ts_node_symbol(node));
+            bool pre_space = (start > 0 && cc_is_space(code[start-1]) && code[start-1]!='\n');
             bool pre_break = (start > 0 && code[start-1] == '\n');
             
             if (len > 0) {
@@ -262,7 +260,7 @@ int main(int argc, char **argv) {
                 }
 
                 if (!already_eaten) {
-                    if (strstr(type, "identifier")) {
+                    if (cls == NODE_IDENTIFIER) {
                         process_identifier(&arena, code, start, len, depth%7, pre_space, sb.st_size);
                     } else {
                         NSET_Token t = {0};
@@ -272,8 +270,8 @@ int main(int argc, char **argv) {
                         t.meta.pre_space = pre_space;
                         t.meta.pre_break = pre_break;
                         
-                        if (strcmp(type, "string_literal")==0) t.meta.type = 1;
-                        else if (isdigit(code[start])) t.meta.type = 2;
+                        if (cls == NODE_STRING) t.meta.type = 1;
+                        else if (cc_is_digit(code[start])) t.meta.type = 2;
                         
                         arena_push(&arena, t, code, sb.st_size);
                     }
@@ -12,7 +12,8 @@
 // ==========================================
 // 1. THE ATOMIC TOKEN (V6 Standard)
 // ==========================================
-// Optimized for 8-byte alignment and bitfield compactness
+// 12 bytes in memory (8-byte aligned fields, bitfield meta); the 8-byte
+// form used for bulk storage is NSET_PackedToken in src/pack.h
 typedef struct {
     uint32_t root_id;       // MurmurHash of the root semantic word
     uint32_t offset;        // Byte offset in the source file
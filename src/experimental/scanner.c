@@ -11,7 +11,6 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
-#include <ctype.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -20,6 +19,9 @@
 
 // Import shared logic
 #include "../entropy.h"
+#include "../snapshot.h"
+#include "../dispatch.h"
+#include "../charclass.h"
 
 // ==========================================
 // 1. DATA STRUCTURES (V6 Standard)
@@ -55,19 +57,20 @@ typedef struct {
 // 2. HELPERS & MODEL
 // ==========================================
 EntropyModel global_model = {0};
+NodeDispatch node_dispatch = {0};  // Leaf class per grammar symbol (see dispatch.h)
 
 uint32_t murmur_hash(const char *key, int len) {
     uint32_t h = 0x811c9dc5;
-    for (int i=0; i<len; i++) { h ^= (uint8_t)tolower(key[i]); h *= 0x01000193; }
+    for (int i=0; i<len; i++) { h ^= cc_lower(key[i]); h *= 0x01000193; }
     return h;
 }
 
 uint8_t get_casing(const char *s, int len) {
     int caps=0;
-    for(int i=0; i<len; i++) if(isupper(s[i])) caps++;
+    for(int i=0; i<len; i++) if(cc_is_upper(s[i])) caps++;
     if(caps==0) return 0;
     if(caps==len) return 2;
-    if(caps==1 && isupper(s[0])) return 1;
+    if(caps==1 && cc_is_upper(s[0])) return 1;
     return 3;
 }
 
@@ -120,7 +123,7 @@ void subtokenize_identifier(Arena *arena, const char *text, int offset, int len,
         // 1. Calculate metrics
         float surprise = calculate_surprise(&global_model, cur, next);
         bool is_underscore = (cur == '_');
-        bool is_camel = (islower(cur) && isupper(next));
+        bool is_camel = (cc_is_lower(cur) && cc_is_upper(next));
         
         bool split = false;
         
@@ -177,14 +180,26 @@ void subtokenize_identifier(Arena *arena, const char *text, int offset, int len,
 extern const TSLanguage *tree_sitter_c();
 
 int main(int argc, char **argv) {
-    if (argc < 2) {
-        printf("Usage: ./scanner <file.c>\n");
+    int argi = 1;
+    const char *model_in = NULL;
+    if (argc > 3 && strcmp(argv[1], "--model-in") == 0) { model_in = argv[2]; argi = 3; }
+    if (argi >= argc) {
+        printf("Usage: ./scanner [--model-in model.bin] <file.c>\n");
         return 1;
     }
 
-    pretrain_model();
+    if (model_in) {
+        // Explain splits as a trained model sees them (a private, writable copy)
+        ModelSnapshot snapshot;
+        if (!model_snapshot_map(model_in, &snapshot)) return 1;
+        memcpy(&global_model, snapshot.model, sizeof(EntropyModel));
+        model_snapshot_unmap(&snapshot);
+        printf(">> Model loaded from %s.\n", model_in);
+    } else {
+        pretrain_model();
+    }
 
-    int fd = open(argv[1], O_RDONLY);
+    int fd = open(argv[argi], O_RDONLY);
     if (fd == -1) { perror("Error opening file"); return 1; }
     
     struct stat sb; fstat(fd, &sb);
@@ -192,8 +207,9 @@ int main(int argc, char **argv) {
 
     TSParser *parser = ts_parser_new();
     ts_parser_set_language(parser, tree_sitter_c());
+    dispatch_init(&node_dispatch, tree_sitter_c());
 
-    printf(">> Parsing structure of %s (%ld bytes)...\n", argv[1], sb.st_size);
+    printf(">> Parsing structure of %s (%ld bytes)...\n", argv[argi], sb.st_size);
     TSTree *tree = ts_parser_parse_string(parser, NULL, source_code, sb.st_size);
     TSNode root_node = ts_tree_root_node(tree);
 
@@ -213,11 +229,11 @@ int main(int argc, char **argv) {
             uint32_t start = ts_node_start_byte(node);
             uint32_t end = ts_node_end_byte(node);
             uint16_t len = end - start;
-            const char *type = ts_node_type(node);
-            bool pre_space = (start > 0 && isspace(source_code[start-1]));
+            NodeClass cls = dispatch_class(&node_dispatch, ts_node_symbol(node));
+            bool pre_space = (start > 0 && cc_is_space(source_code[start-1]));
             
             if (len > 0) {
-                if (strstr(type, "identifier")) {
+                if (cls == NODE_IDENTIFIER) {
                     printf("Analyzed Identifier: %.*s\n", len, source_code + start); 
                     subtokenize_identifier(&arena, source_code, start, len, depth % 7, pre_space);
                 } else {
@@ -227,7 +243,7 @@ int main(int argc, char **argv) {
                     t.offset = start; t.length = len;
                     t.meta.depth = depth % 7;
                     t.meta.pre_space = pre_space;
-                    if (isdigit(source_code[start])) t.meta.type = 2;
+                    if (cc_is_digit(source_code[start])) t.meta.type = 2;
                     arena_push(&arena, t);
                 }
             }
@@ -0,0 +1,219 @@
+/* * NSET v6.0 - Vocabulary Journal
+ * -------------------------------------------------------
+ * Group-commit writer for the registry tail.
+ * - Appenders copy records into the active buffer (one short memcpy
+ *   under a mutex) and return; they never touch the file.
+ * - A background thread swaps buffers and writes each batch with a
+ *   single write() on an O_APPEND descriptor, so records from several
+ *   processes never interleave mid-record.
+ * - Each commit holds a shared flock() on the file. Compaction and
+ *   torn-record truncation (registry.h) take it exclusively, so they
+ *   never see a batch half written. Compaction renames a fresh file over
+ *   the path; a commit that finds the path on another inode reopens it
+ *   first, so no batch goes to the unlinked file.
+ * - Durability is explicit: JOURNAL_FSYNC_NONE leaves it to the OS,
+ *   JOURNAL_FSYNC_CLOSE syncs once at shutdown, JOURNAL_FSYNC_BATCH
+ *   syncs after every group commit.
+ */
+
+#ifndef NSET_JOURNAL_H
+#define NSET_JOURNAL_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define JOURNAL_BUFFER_SIZE (1 << 20)   // Batch size that triggers a commit
+#define JOURNAL_INTERVAL_MS 50          // Max time a record waits in memory
+
+typedef enum {
+    JOURNAL_FSYNC_NONE,
+    JOURNAL_FSYNC_CLOSE,
+    JOURNAL_FSYNC_BATCH
+} JournalFsync;
+
+typedef struct {
+    uint8_t *data;
+    size_t len;
+} JournalBuffer;
+
+typedef struct {
+    int fd;
+    char path[4096];            // Reopened when compaction replaces the file
+    JournalFsync fsync_policy;
+    JournalBuffer active;       // Filled by appenders
+    JournalBuffer flushing;     // Owned by the writer while a commit runs
+    bool commit_in_flight;
+    bool stop;
+    pthread_t writer;
+    pthread_mutex_t lock;
+    pthread_cond_t wake_writer;
+    pthread_cond_t space;
+    // Stats
+    uint64_t records;
+    uint64_t bytes;
+    uint64_t flushes;
+    uint64_t flush_ns_total;
+    uint64_t flush_ns_max;
+    uint64_t reopens;           // Files replaced by another process's compaction
+    int error;                  // First errno seen by the writer
+} VocabJournal;
+
+static inline uint64_t journal_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void journal_write_all(VocabJournal *j, const uint8_t *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(j->fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (!j->error) j->error = errno;
+            return;
+        }
+        data += n; len -= n;
+    }
+}
+
+// Takes the shared lock for one commit, on the file the path names now.
+// If the path is gone, the batch goes to the file already open.
+static void journal_lock(VocabJournal *j) {
+    for (;;) {
+        if (flock(j->fd, LOCK_SH) != 0) {
+            if (!j->error) j->error = errno;
+            return;
+        }
+        struct stat held, now;
+        if (fstat(j->fd, &held) != 0 || stat(j->path, &now) != 0) return;
+        if (held.st_dev == now.st_dev && held.st_ino == now.st_ino) return;
+        int fd = open(j->path, O_WRONLY | O_APPEND);
+        if (fd < 0) return;
+        close(j->fd);           // Drops the lock on the old file
+        j->fd = fd;
+        j->reopens++;
+    }
+}
+
+static void *journal_writer_main(void *arg) {
+    VocabJournal *j = arg;
+    pthread_mutex_lock(&j->lock);
+    for (;;) {
+        while (j->active.len == 0 && !j->stop) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += JOURNAL_INTERVAL_MS * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) { deadline.tv_sec++; deadline.tv_nsec -= 1000000000L; }
+            pthread_cond_timedwait(&j->wake_writer, &j->lock, &deadline);
+        }
+        if (j->active.len == 0 && j->stop) break;
+
+        // Swap: appenders keep going into the (empty) other buffer
+        JournalBuffer batch = j->active;
+        j->active = j->flushing;
+        j->flushing = batch;
+        j->commit_in_flight = true;
+        pthread_cond_broadcast(&j->space);
+        pthread_mutex_unlock(&j->lock);
+
+        uint64_t t0 = journal_now_ns();
+        journal_lock(j);
+        journal_write_all(j, batch.data, batch.len);
+        if (j->fsync_policy == JOURNAL_FSYNC_BATCH) fdatasync(j->fd);
+        flock(j->fd, LOCK_UN);
+        uint64_t dt = journal_now_ns() - t0;
+
+        pthread_mutex_lock(&j->lock);
+        j->flushing.len = 0;
+        j->commit_in_flight = false;
+        j->flushes++;
+        j->bytes += batch.len;
+        j->flush_ns_total += dt;
+        if (dt > j->flush_ns_max) j->flush_ns_max = dt;
+        pthread_cond_broadcast(&j->space);
+    }
+    pthread_mutex_unlock(&j->lock);
+    return NULL;
+}
+
+static bool journal_open(VocabJournal *j, const char *path, JournalFsync policy) {
+    memset(j, 0, sizeof(*j));
+    j->fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (j->fd < 0) return false;
+    snprintf(j->path, sizeof(j->path), "%s", path);
+    j->fsync_policy = policy;
+    j->active.data = malloc(JOURNAL_BUFFER_SIZE);
+    j->flushing.data = malloc(JOURNAL_BUFFER_SIZE);
+    pthread_mutex_init(&j->lock, NULL);
+    pthread_cond_init(&j->wake_writer, NULL);
+    pthread_cond_init(&j->space, NULL);
+    pthread_create(&j->writer, NULL, journal_writer_main, j);
+    return true;
+}
+
+// Appends one record made of two parts (header + payload). Blocks only when
+// both buffers are full, i.e. when the disk really cannot keep up.
+static void journal_append(VocabJournal *j, const void *head, size_t head_len,
+                           const void *body, size_t body_len) {
+    size_t len = head_len + body_len;
+    pthread_mutex_lock(&j->lock);
+    while (j->active.len + len > JOURNAL_BUFFER_SIZE) {
+        pthread_cond_signal(&j->wake_writer);
+        pthread_cond_wait(&j->space, &j->lock);
+    }
+    memcpy(j->active.data + j->active.len, head, head_len);
+    memcpy(j->active.data + j->active.len + head_len, body, body_len);
+    j->active.len += len;
+    j->records++;
+    // A full batch goes out now; smaller ones wait for the interval timer
+    if (j->active.len >= JOURNAL_BUFFER_SIZE / 2 && !j->commit_in_flight)
+        pthread_cond_signal(&j->wake_writer);
+    pthread_mutex_unlock(&j->lock);
+}
+
+static void journal_close(VocabJournal *j) {
+    if (j->fd < 0) return;
+    pthread_mutex_lock(&j->lock);
+    j->stop = true;
+    pthread_cond_signal(&j->wake_writer);
+    pthread_mutex_unlock(&j->lock);
+    pthread_join(j->writer, NULL);
+
+    if (j->fsync_policy != JOURNAL_FSYNC_NONE) fdatasync(j->fd);
+    close(j->fd);
+    if (j->error) fprintf(stderr, "Error writing vocabulary journal: %s\n", strerror(j->error));
+    if (j->flushes > 0)
+        printf(">> Vocab journal: %lu records in %lu commits, flush avg %.1f us, max %.1f us.\n",
+               (unsigned long)j->records, (unsigned long)j->flushes,
+               j->flush_ns_total / 1000.0 / j->flushes, j->flush_ns_max / 1000.0);
+    if (j->reopens > 0)
+        printf(">> Vocab journal followed %lu compactions by other processes.\n", (unsigned long)j->reopens);
+
+    free(j->active.data);
+    free(j->flushing.data);
+    pthread_mutex_destroy(&j->lock);
+    pthread_cond_destroy(&j->wake_writer);
+    pthread_cond_destroy(&j->space);
+    j->active.data = j->flushing.data = NULL;
+    j->fd = -1;
+}
+
+static inline bool journal_parse_fsync(const char *s, JournalFsync *out) {
+    if (strcmp(s, "none") == 0) *out = JOURNAL_FSYNC_NONE;
+    else if (strcmp(s, "close") == 0) *out = JOURNAL_FSYNC_CLOSE;
+    else if (strcmp(s, "batch") == 0) *out = JOURNAL_FSYNC_BATCH;
+    else return false;
+    return true;
+}
+
+#endif
@@ -0,0 +1,87 @@
+/* * NSET v6.0 - Leaf Span Buffer
+ * -------------------------------------------------------
+ * Phase one of tokenization: one walk of the syntax tree that records
+ * every leaf as (start, end, symbol, depth) in parallel arrays. After
+ * it the tree is no longer needed and can be freed, so splitting and
+ * emission (phase two) run over flat arrays with no cursor calls in
+ * the loop and without the tree's memory still held.
+ * The walk also notes the first leaf of every top-level item (child of
+ * the root), where phase two may be split across threads (ranges.h).
+ * The buffer belongs to a worker and is reused across files; it only
+ * grows.
+ */
+
+#ifndef NSET_LEAVES_H
+#define NSET_LEAVES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <tree_sitter/api.h>
+
+typedef struct {
+    uint32_t *start;
+    uint32_t *end;
+    TSSymbol *symbol;
+    uint8_t *depth;       // Tree depth mod 7 (what NSET_Token.meta.depth holds)
+    uint8_t *cls;         // NodeClass, filled by the classify pass
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t *top;        // First leaf of each top-level item
+    uint32_t top_count, top_capacity;
+} LeafSpans;
+
+static inline void leaves_reserve(LeafSpans *l, uint32_t n) {
+    if (n <= l->capacity) return;
+    uint32_t cap = l->capacity ? l->capacity : 1024;
+    while (cap < n) cap *= 2;
+    l->start = realloc(l->start, cap * sizeof(uint32_t));
+    l->end = realloc(l->end, cap * sizeof(uint32_t));
+    l->symbol = realloc(l->symbol, cap * sizeof(TSSymbol));
+    l->depth = realloc(l->depth, cap);
+    l->cls = realloc(l->cls, cap);
+    l->capacity = cap;
+}
+
+// Records every leaf of the tree, in document order.
+static inline void leaves_collect(LeafSpans *l, const TSTree *tree) {
+    l->count = l->top_count = 0;
+    TSTreeCursor cursor = ts_tree_cursor_new(ts_tree_root_node(tree));
+    int depth = 0;
+    for (;;) {
+        TSNode node = ts_tree_cursor_current_node(&cursor);
+        if (depth == 1) {
+            if (l->top_count == l->top_capacity) {
+                l->top_capacity = l->top_capacity ? l->top_capacity * 2 : 256;
+                l->top = realloc(l->top, l->top_capacity * sizeof(uint32_t));
+            }
+            l->top[l->top_count++] = l->count;
+        }
+        if (ts_node_child_count(node) == 0) {
+            if (l->count == l->capacity) leaves_reserve(l, l->count + 1);
+            uint32_t i = l->count++;
+            l->start[i] = ts_node_start_byte(node);
+            l->end[i] = ts_node_end_byte(node);
+            l->symbol[i] = ts_node_symbol(node);
+            l->depth[i] = depth % 7;
+        }
+        if (ts_tree_cursor_goto_first_child(&cursor)) { depth++; continue; }
+        if (ts_tree_cursor_goto_next_sibling(&cursor)) continue;
+        bool more = false;
+        while (ts_tree_cursor_goto_parent(&cursor)) {
+            depth--;
+            if ((more = ts_tree_cursor_goto_next_sibling(&cursor))) break;
+        }
+        if (!more) break;
+    }
+    ts_tree_cursor_delete(&cursor);
+}
+
+static inline void leaves_free(LeafSpans *l) {
+    free(l->start); free(l->end); free(l->symbol); free(l->depth); free(l->cls); free(l->top);
+    l->start = l->end = l->top = NULL; l->symbol = NULL; l->depth = l->cls = NULL;
+    l->count = l->capacity = 0;
+    l->top_count = l->top_capacity = 0;
+}
+
+#endif
@@ -0,0 +1,218 @@
+/* * NSET v6.0 - Locked Word Set
+ * -------------------------------------------------------
+ * Words that are never split (keywords, libc names, project terms).
+ * Matching is case-insensitive: keys are stored lowercased.
+ *
+ * The set is built once at startup into a minimal perfect hash
+ * (hash-and-displace): every key gets its own slot, and a lookup is
+ * one hash of the input (lowercased on the fly, no copy), one
+ * displacement read, and one compare against the only candidate.
+ * A bitmask of the key lengths rejects most inputs before hashing.
+ * Extra words come from a plain word file, one per line ('#' starts
+ * a comment), so projects extend the set without recompiling.
+ */
+
+#ifndef NSET_LOCKED_H
+#define NSET_LOCKED_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "charclass.h"
+
+#define LOCKED_MAX_WORD 63      // Longer inputs are never locked
+
+typedef struct {
+    char (*keys)[LOCKED_MAX_WORD + 1];  // By slot, lowercased, NUL-terminated
+    uint8_t *lens;                      // By slot; 0 = empty
+    uint32_t *disp;                     // Displacement per bucket
+    uint32_t n_slots;
+    uint32_t n_buckets;
+    uint32_t count;
+    uint64_t len_mask;                  // Bit n set if some key has length n
+    int max_len;
+    // Staging area until locked_build()
+    char (*pending)[LOCKED_MAX_WORD + 1];
+    uint32_t n_pending, cap_pending;
+} LockedSet;
+
+static inline uint64_t locked_hash(const char *s, int len) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (int i = 0; i < len; i++) { h ^= cc_lower(s[i]); h *= 0x100000001b3ull; }
+    return h;
+}
+
+static inline uint32_t locked_slot(uint64_t h, uint32_t d, uint32_t n_slots) {
+    uint64_t x = h ^ ((uint64_t)d * 0x9e3779b97f4a7c15ull);
+    x ^= x >> 33; x *= 0xff51afd7ed558ccdull; x ^= x >> 33;
+    return (uint32_t)(x % n_slots);
+}
+
+static inline bool locked_contains(const LockedSet *s, const char *str, int len) {
+    if (len <= 0 || len > LOCKED_MAX_WORD || !((s->len_mask >> len) & 1)) return false;
+    uint64_t h = locked_hash(str, len);
+    uint32_t slot = locked_slot(h, s->disp[(h >> 32) % s->n_buckets], s->n_slots);
+    if (s->lens[slot] != len) return false;
+    const char *key = s->keys[slot];
+    for (int i = 0; i < len; i++) if (cc_lower(str[i]) != (uint8_t)key[i]) return false;
+    return true;
+}
+
+// ==========================================
+// BUILDING
+// ==========================================
+static inline bool locked_add(LockedSet *s, const char *word, int len) {
+    if (len <= 0 || len > LOCKED_MAX_WORD) return false;
+    if (s->n_pending == s->cap_pending) {
+        s->cap_pending = s->cap_pending ? s->cap_pending * 2 : 128;
+        s->pending = realloc(s->pending, s->cap_pending * sizeof(*s->pending));
+    }
+    char *key = s->pending[s->n_pending++];
+    for (int i = 0; i < len; i++) key[i] = cc_lower(word[i]);
+    key[len] = '\0';
+    return true;
+}
+
+// Adds every word of a word file. Returns the number added, -1 if unreadable.
+static inline int locked_load_file(LockedSet *s, const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    char line[1024];
+    int added = 0;
+    while (fgets(line, sizeof(line), f)) {
+        char *hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+        char *w = line;
+        while (cc_is_space(*w)) w++;
+        int len = strlen(w);
+        while (len > 0 && cc_is_space(w[len - 1])) len--;
+        if (len == 0) continue;
+        if (locked_add(s, w, len)) added++;
+        else fprintf(stderr, "Warning: locked word longer than %d bytes ignored: %.*s\n", LOCKED_MAX_WORD, len, w);
+    }
+    fclose(f);
+    return added;
+}
+
+typedef struct { uint64_t hash; uint32_t key; } LockedItem;
+
+static int locked_item_cmp(const void *a, const void *b) {
+    const LockedItem *x = a, *y = b;
+    if (x->hash != y->hash) return x->hash < y->hash ? -1 : 1;
+    return (x->key > y->key) - (x->key < y->key);
+}
+
+// Bucket order for placement: largest buckets first (they are hardest to fit).
+static const uint32_t *locked_sort_sizes;
+static int locked_bucket_cmp(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    if (locked_sort_sizes[x] != locked_sort_sizes[y]) return locked_sort_sizes[x] < locked_sort_sizes[y] ? 1 : -1;
+    return (x > y) - (x < y);
+}
+
+// Tries to place every key with `n_slots` slots. False if some bucket
+// found no displacement in the search budget.
+static inline bool locked_place(LockedSet *s, const LockedItem *items, uint32_t n, uint32_t n_slots) {
+    uint32_t n_buckets = n / 4 + 1;
+    uint32_t *sizes = calloc(n_buckets, sizeof(uint32_t));
+    uint32_t *start = calloc(n_buckets + 1, sizeof(uint32_t));
+    uint32_t *members = malloc(n * sizeof(uint32_t));
+    uint32_t *order = malloc(n_buckets * sizeof(uint32_t));
+    uint8_t *taken = calloc(n_slots, 1);
+    uint32_t *disp = calloc(n_buckets, sizeof(uint32_t));
+    uint32_t *trial = malloc(n * sizeof(uint32_t));
+
+    for (uint32_t i = 0; i < n; i++) sizes[(items[i].hash >> 32) % n_buckets]++;
+    for (uint32_t b = 0; b < n_buckets; b++) start[b + 1] = start[b] + sizes[b];
+    uint32_t *fill = calloc(n_buckets, sizeof(uint32_t));
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t b = (items[i].hash >> 32) % n_buckets;
+        members[start[b] + fill[b]++] = i;
+    }
+    free(fill);
+    for (uint32_t b = 0; b < n_buckets; b++) order[b] = b;
+    locked_sort_sizes = sizes;
+    qsort(order, n_buckets, sizeof(uint32_t), locked_bucket_cmp);
+
+    bool ok = true;
+    for (uint32_t o = 0; o < n_buckets && ok && sizes[order[o]] > 0; o++) {
+        uint32_t b = order[o];
+        bool placed = false;
+        for (uint32_t d = 0; d < (1u << 20) && !placed; d++) {
+            placed = true;
+            for (uint32_t k = 0; k < sizes[b] && placed; k++) {
+                uint32_t slot = locked_slot(items[members[start[b] + k]].hash, d, n_slots);
+                if (taken[slot]) placed = false;
+                for (uint32_t j = 0; j < k && placed; j++) placed = (trial[j] != slot);
+                trial[k] = slot;
+            }
+            if (placed) {
+                for (uint32_t k = 0; k < sizes[b]; k++) taken[trial[k]] = 1;
+                disp[b] = d;
+            }
+        }
+        ok = placed;
+    }
+
+    if (ok) {
+        s->keys = calloc(n_slots, sizeof(*s->keys));
+        s->lens = calloc(n_slots, 1);
+        s->disp = disp;
+        s->n_slots = n_slots;
+        s->n_buckets = n_buckets;
+        for (uint32_t i = 0; i < n; i++) {
+            const char *key = s->pending[items[i].key];
+            uint32_t b = (items[i].hash >> 32) % n_buckets;
+            uint32_t slot = locked_slot(items[i].hash, disp[b], n_slots);
+            strcpy(s->keys[slot], key);
+            s->lens[slot] = strlen(key);
+        }
+    } else {
+        free(disp);
+    }
+    free(sizes); free(start); free(members); free(order); free(taken); free(trial);
+    return ok;
+}
+
+// Turns the staged words into the lookup table. Duplicates are dropped.
+static inline void locked_build(LockedSet *s) {
+    uint32_t n = 0;
+    LockedItem *items = malloc((s->n_pending + 1) * sizeof(LockedItem));
+    for (uint32_t i = 0; i < s->n_pending; i++) {
+        items[i].hash = locked_hash(s->pending[i], strlen(s->pending[i]));
+        items[i].key = i;
+    }
+    qsort(items, s->n_pending, sizeof(LockedItem), locked_item_cmp);
+    for (uint32_t i = 0; i < s->n_pending; i++) {
+        if (n > 0 && items[n - 1].hash == items[i].hash &&
+            strcmp(s->pending[items[n - 1].key], s->pending[items[i].key]) == 0) continue;
+        items[n++] = items[i];
+    }
+
+    s->count = n;
+    s->len_mask = 0;
+    s->max_len = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        int len = strlen(s->pending[items[i].key]);
+        s->len_mask |= 1ull << len;
+        if (len > s->max_len) s->max_len = len;
+    }
+    // Minimal (one slot per key) almost always works; widen only if it does not
+    uint32_t n_slots = n ? n : 1;
+    while (!locked_place(s, items, n, n_slots)) n_slots += n_slots / 8 + 1;
+
+    free(items);
+    free(s->pending);
+    s->pending = NULL;
+    s->n_pending = s->cap_pending = 0;
+}
+
+static inline void locked_free(LockedSet *s) {
+    free(s->keys); free(s->lens); free(s->disp); free(s->pending);
+    memset(s, 0, sizeof(*s));
+}
+
+#endif
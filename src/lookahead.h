@@ -0,0 +1,158 @@
+/* * NSET v6.0 - Symbol Absorption Lookahead
+ * -------------------------------------------------------
+ * Decides, once per file, which symbols get folded into the token in
+ * front of them. Two bitmaps over the source, bit i of word i/64 for
+ * byte i:
+ * - sig    : significant (non-space) bytes, classified 32 or 16 bytes
+ *            at a time with AVX2 / SSE2 (charclass table otherwise)
+ * - absorb : starts of leaves that are an absorbable symbol on their
+ *            own: ; , ( ) * { } [ ] . and ->
+ *            Compound operators (*=, ..., .5) are different leaves and
+ *            are never marked.
+ * A token absorbs the symbol at the next significant byte after it if
+ * that byte is marked, and a leaf is eaten when it starts exactly there.
+ * Finding that byte is a bit scan over `sig`, so no byte of whitespace
+ * is looked at twice however long the run.
+ * The buffers belong to a worker and are reused across files.
+ */
+
+#ifndef NSET_LOOKAHEAD_H
+#define NSET_LOOKAHEAD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "arena.h"
+#include "charclass.h"
+
+// ABSORB_* code by first byte; '-' only ever stands for "->"
+static const uint8_t ABSORB_OF[256] = {
+    [';'] = ABSORB_SEMI, [','] = ABSORB_COMMA, ['('] = ABSORB_PAREN, [')'] = ABSORB_CLOSE,
+    ['*'] = ABSORB_STAR, ['{'] = ABSORB_BRACE, ['}'] = ABSORB_CLOSE_BRACE,
+    ['['] = ABSORB_BRACKET, [']'] = ABSORB_CLOSE_BRACKET, ['.'] = ABSORB_DOT, ['-'] = ABSORB_ARROW,
+};
+
+static const char *const ABSORB_TEXT[ABSORB_COUNT] = {
+    NULL, ";", ",", "(", ")", "*", "{", "}", "[", "]", ".", "->",
+};
+
+typedef struct {
+    const char *code;
+    size_t size;
+    uint64_t *sig;
+    uint64_t *absorb;
+    size_t words, capacity;
+} Lookahead;
+
+// ==========================================
+// SIGNIFICANCE MAP
+// ==========================================
+// Each one returns the significant-byte mask of a full block.
+#if defined(__AVX2__)
+#define LA_BLOCK 32
+static inline uint64_t la_block(const uint8_t *p) {
+    __m256i c = _mm256_loadu_si256((const __m256i *)p);
+    // ' ' or \t..\r; signed compares keep bytes >= 0x80 out of the range
+    __m256i sp = _mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8(' ')),
+                                 _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('\t' - 1)),
+                                                  _mm256_cmpgt_epi8(_mm256_set1_epi8('\r' + 1), c)));
+    return ~(uint64_t)(uint32_t)_mm256_movemask_epi8(sp) & 0xFFFFFFFFull;
+}
+#elif defined(__SSE2__)
+#define LA_BLOCK 16
+static inline uint64_t la_block(const uint8_t *p) {
+    __m128i c = _mm_loadu_si128((const __m128i *)p);
+    __m128i sp = _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8(' ')),
+                              _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('\t' - 1)),
+                                            _mm_cmplt_epi8(c, _mm_set1_epi8('\r' + 1))));
+    return ~(uint64_t)(uint16_t)_mm_movemask_epi8(sp) & 0xFFFFull;
+}
+#else
+#define LA_BLOCK 8
+static inline uint64_t la_block(const uint8_t *p) {
+    uint64_t m = 0;
+    for (int k = 0; k < LA_BLOCK; k++) if (!cc_is_space(p[k])) m |= 1ull << k;
+    return m;
+}
+#endif
+
+// Builds the significance map of code[0, size) and clears the absorb map.
+static inline void lookahead_build(Lookahead *la, const char *code, size_t size) {
+    la->code = code;
+    la->size = size;
+    la->words = (size + 63) / 64;
+    if (la->words > la->capacity) {
+        la->capacity = la->words;
+        free(la->sig); free(la->absorb);
+        la->sig = malloc(la->capacity * sizeof(uint64_t));
+        la->absorb = malloc(la->capacity * sizeof(uint64_t));
+    }
+    memset(la->absorb, 0, la->words * sizeof(uint64_t));
+
+    const uint8_t *s = (const uint8_t *)code;
+    size_t i = 0;
+    for (; i + 64 <= size; i += 64) {
+        uint64_t m = 0;
+        for (int b = 0; b < 64; b += LA_BLOCK) m |= la_block(s + i + b) << b;
+        la->sig[i / 64] = m;
+    }
+    if (i < size) {
+        // Tail: bits past the end stay clear
+        uint64_t m = 0;
+        for (size_t k = 0; i + k < size; k++) if (!cc_is_space(s[i + k])) m |= 1ull << k;
+        la->sig[i / 64] = m;
+    }
+}
+
+// Marks the leaf [start, end) if it is an absorbable symbol by itself.
+static inline void lookahead_mark_leaf(Lookahead *la, uint32_t start, uint32_t end) {
+    const uint8_t *p = (const uint8_t *)la->code + start;
+    uint8_t code = ABSORB_OF[p[0]];
+    if (!code) return;
+    bool whole = (code == ABSORB_ARROW) ? (end - start == 2 && p[1] == '>') : (end - start == 1);
+    if (whole) la->absorb[start >> 6] |= 1ull << (start & 63);
+}
+
+// ==========================================
+// QUERIES
+// ==========================================
+// First significant byte at or after pos; la->size if none.
+static inline size_t lookahead_next(const Lookahead *la, size_t pos) {
+    size_t w = pos >> 6;
+    if (w >= la->words) return la->size;
+    uint64_t m = la->sig[w] & (~0ull << (pos & 63));
+    while (!m) {
+        if (++w == la->words) return la->size;
+        m = la->sig[w];
+    }
+    return (w << 6) + __builtin_ctzll(m);
+}
+
+static inline bool lookahead_marked(const Lookahead *la, size_t pos) {
+    return pos < la->size && ((la->absorb[pos >> 6] >> (pos & 63)) & 1);
+}
+
+// ABSORB_* code for a token ending at `end`: the marked symbol right after it, if any.
+static inline uint8_t lookahead_absorb(const Lookahead *la, size_t end) {
+    size_t next = lookahead_next(la, end);
+    return lookahead_marked(la, next) ? ABSORB_OF[(uint8_t)la->code[next]] : ABSORB_NONE;
+}
+
+// True if the leaf starting at `start` was absorbed by the token ending at `prev_end`.
+static inline bool lookahead_eaten(const Lookahead *la, size_t prev_end, size_t start) {
+    return lookahead_marked(la, start) && lookahead_next(la, prev_end) == start;
+}
+
+static inline void lookahead_free(Lookahead *la) {
+    free(la->sig); free(la->absorb);
+    memset(la, 0, sizeof(*la));
+}
+
+#endif
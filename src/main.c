@@ -1,6 +1,6 @@
 /* * NSET v6.0 - Persistent Memory & Macro Buster
  * -------------------------------------------------------
- * 1. Loads existing vocab at startup (Fixes Duplicates)
+ * 1. Maps the indexed vocab registry at startup (Fixes Duplicates)
  * 2. Splits Macros/Preproc definitions (Fixes Blobs)
  * 3. Length Guard: Forces split on anything > 32 chars
  */
@@ -10,107 +10,50 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
-#include <ctype.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <dirent.h>
+#include <errno.h>
 
 // Professional Includes
 #include "entropy.h"
+#include "registry.h"
+#include "pool.h"
+#include "memo.h"
+#include "charclass.h"
+#include "segment.h"
+#include "snapshot.h"
+#include "locked.h"
+#include "dispatch.h"
+#include "stream.h"
+#include "leaves.h"
+#include "tsalloc.h"
+#include "arena.h"
+#include "pack.h"
+#include "lookahead.h"
+#include "ring.h"
+#include "ranges.h"
 
 // Compile via Makefile
 
 // ==========================================
 // DATA STRUCTURES
 // ==========================================
-// Note: This differs slightly from core.h because we need 'offset'
-// for runtime tracking within the memory-mapped file.
-typedef struct {
-    uint32_t root_id;
-    uint32_t offset;
-    uint16_t length;
-    struct {
-        uint16_t type       : 3; 
-        uint16_t casing     : 2; 
-        uint16_t pre_space  : 1; 
-        uint16_t pre_break  : 1; 
-        uint16_t has_joiner : 1; 
-        uint16_t depth      : 3; 
-        uint16_t has_semi   : 1; 
-        uint16_t has_comma  : 1; 
-        uint16_t has_paren  : 1; 
-        uint16_t has_star   : 1; 
-        uint16_t has_close  : 1; 
-    } meta;
-} NSET_Token;
-
-typedef struct {
-    NSET_Token *tokens;
-    size_t count;
-    size_t capacity;
-} Arena;
-
-// ==========================================
-// REGISTRY (PERSISTENT MEMORY)
-// ==========================================
-#define SEEN_TABLE_SIZE 4194304 // 4M entries
-uint32_t *seen_hashes = NULL;
-FILE *vocab_file = NULL;
-
-void init_registry() {
-    seen_hashes = calloc(SEEN_TABLE_SIZE, sizeof(uint32_t));
-}
-
-void load_registry() {
-    FILE *f = fopen("nset_vocab.bin", "rb");
-    if (!f) return; 
-
-    printf(">> Loading existing vocabulary into RAM...\n");
-    uint32_t id;
-    uint8_t len;
-    
-    while (fread(&id, sizeof(uint32_t), 1, f) == 1) {
-        if (fread(&len, sizeof(uint8_t), 1, f) != 1) break;
-        fseek(f, len, SEEK_CUR); 
-        
-        uint32_t idx = id % SEEN_TABLE_SIZE;
-        while (seen_hashes[idx] != 0) idx = (idx + 1) % SEEN_TABLE_SIZE;
-        seen_hashes[idx] = id;
-    }
-    fclose(f);
-}
-
-bool has_seen_id(uint32_t id) {
-    uint32_t idx = id % SEEN_TABLE_SIZE;
-    while (seen_hashes[idx] != 0) {
-        if (seen_hashes[idx] == id) return true;
-        idx = (idx + 1) % SEEN_TABLE_SIZE;
-    }
-    return false;
-}
-
-void register_token(uint32_t id, const char *text, int len) {
-    if (!has_seen_id(id)) {
-        uint32_t idx = id % SEEN_TABLE_SIZE;
-        while (seen_hashes[idx] != 0) idx = (idx + 1) % SEEN_TABLE_SIZE;
-        seen_hashes[idx] = id;
-        
-        if (vocab_file) {
-            uint8_t l = (len > 255) ? 255 : (uint8_t)len;
-            fwrite(&id, sizeof(uint32_t), 1, vocab_file);
-            fwrite(&l, sizeof(uint8_t), 1, vocab_file);
-            fwrite(text, 1, l, vocab_file);
-        }
-    }
-}
+// NSET_Token and the token Arena live in arena.h.
 
 // ==========================================
 // HELPERS
 // ==========================================
-// Global Statistical Model (Defined in entropy.h struct)
-EntropyModel global_model = {0};
+// Pre-trained Statistical Model (Defined in entropy.h struct).
+// Read-only once tokenization starts; every file begins from a copy of it.
+// Points at seed_model (pretrained on LOCKED_VOCAB) or at a mapped snapshot.
+EntropyModel seed_model = {0};
+const EntropyModel *base_model = &seed_model;
+// --two-pass: the corpus-trained model, shared by all workers and never written
+const EntropyModel *frozen_model = NULL;
 
 const char *LOCKED_VOCAB[] = {
     "auto", "break", "case", "char", "const", "continue", "default", "do", 
@@ -123,122 +66,131 @@ const char *LOCKED_VOCAB[] = {
     "count", "offset", "data", "node", "tree", "parser", "cursor", "root"
 };
 
-int vocab_cmp(const void *a, const void *b) {
-    return strcmp((const char*)a, *(const char**)b);
-}
-
-bool is_word_locked(const char *str, int len) {
-    char buffer[64];
-    if (len >= 64) return false;
-    for(int i=0; i<len; i++) buffer[i] = tolower(str[i]);
-    buffer[len] = '\0';
-    const char *key = buffer;
-    return bsearch(key, LOCKED_VOCAB, sizeof(LOCKED_VOCAB)/sizeof(char*), sizeof(char*), vocab_cmp) != NULL;
+// LOCKED_VOCAB plus any --locked-words file, built once at startup
+LockedSet locked_words = {0};
+// Leaf handler class per grammar symbol (tree_sitter_c), built at startup
+NodeDispatch node_dispatch = {0};
+// -o: token stream output, one entry per input file (fd < 0 when off)
+TokenStream token_stream = { .fd = -1 };
+// Ring buffer size for input read from stdin (--stdin-buffer)
+size_t stdin_ring_size = (size_t)64 << 20;
+// Intra-file ranges (ranges.h): source bytes per range (0 = off, --range-size),
+// the workers of the file pool, and the board their idle ones take range jobs from
+uint64_t range_bytes = (uint64_t)1 << 20;
+int range_threads = 1;
+RangeBoard range_board;
+
+static inline bool is_word_locked(const char *str, int len) {
+    return locked_contains(&locked_words, str, len);
 }
 
 uint32_t murmur_hash(const char *key, int len) {
     uint32_t h = 0x811c9dc5;
-    for (int i=0; i<len; i++) { h ^= (uint8_t)tolower(key[i]); h *= 0x01000193; }
-    return h;
+    for (int i=0; i<len; i++) { h ^= cc_lower(key[i]); h *= 0x01000193; }
+    // Keep hashed ids out of the reserved range
+    return h < NSET_RESERVED_IDS ? h + NSET_RESERVED_IDS : h;
 }
 
-uint8_t get_casing(const char *s, int len) {
-    int caps=0;
-    for(int i=0; i<len; i++) if(isupper(s[i])) caps++;
-    if(caps==0) return 0;
-    if(caps==len) return 2;
-    if(caps==1 && isupper(s[0])) return 1;
-    return 3;
+// Stores a token, absorbing the symbol right after it (if any) into its meta.
+void arena_emit(Arena *a, NSET_Token t, const Lookahead *la) {
+    t.meta.absorbed = lookahead_absorb(la, t.offset + t.length);
+    arena_append(a, &t);
 }
 
-void arena_push(Arena *a, NSET_Token t, const char *code, size_t total_size) {
-    if (a->count >= a->capacity) return;
-    uint32_t next_pos = t.offset + t.length;
-    while (next_pos < total_size && isspace(code[next_pos])) next_pos++;
-
-    if (next_pos < total_size) {
-        char next_char = code[next_pos];
-        if (next_char == ';') t.meta.has_semi = 1;
-        else if (next_char == ',') t.meta.has_comma = 1;
-        else if (next_char == '(') t.meta.has_paren = 1;
-        else if (next_char == ')') t.meta.has_close = 1;
-        else if (next_char == '*') t.meta.has_star = 1;
-    }
-    register_token(t.root_id, code + t.offset, t.length);
-    a->tokens[a->count++] = t;
+void arena_push(Arena *a, NSET_Token t, const Lookahead *la) {
+    register_token(t.root_id, la->code + t.offset, t.length);
+    arena_emit(a, t, la);
 }
 
 // ==========================================
 // IDENTIFIER PROCESSOR
 // ==========================================
-void process_identifier(Arena *arena, const char *src, int offset, int len, int depth, bool pre_space, size_t file_size) {
+// `model` decides the splits; `learn` (the same model, or NULL when frozen)
+// is trained on the word first.
+void process_identifier(Arena *arena, const EntropyModel *model, EntropyModel *learn, MemoCache *memo, const char *src, int offset, int len, int depth, bool pre_space, const Lookahead *la) {
     // 1. Check Locks
     if (is_word_locked(src + offset, len)) {
         NSET_Token t = {0};
         t.root_id = murmur_hash(src + offset, len);
         t.offset = offset; t.length = len;
         t.meta.depth = depth; t.meta.pre_space = pre_space;
-        arena_push(arena, t, src, file_size);
+        arena_push(arena, t, la);
         
         // Train the model on this locked word so it learns "this is normal"
-        model_train_sequence(&global_model, src + offset, len);
+        if (learn) model_train_sequence(learn, src + offset, len);
         return;
     }
 
     // 2. Train on current word
-    model_train_sequence(&global_model, src + offset, len);
+    if (learn) model_train_sequence(learn, src + offset, len);
+
+    // 3. Cached split: a copy into the arena (pieces are already registered)
+    const MemoEntry *hit = memo ? memo_lookup(memo, model, src + offset, len) : NULL;
+    if (hit) {
+        for (int p = 0; p < hit->n_pieces; p++) {
+            NSET_Token t = {0};
+            t.root_id = hit->pieces[p].root_id;
+            t.offset = offset + hit->pieces[p].start; t.length = hit->pieces[p].length;
+            t.meta.casing = hit->pieces[p].casing;
+            t.meta.has_joiner = hit->pieces[p].has_joiner;
+            t.meta.depth = depth;
+            t.meta.pre_space = (p == 0) ? pre_space : 0;
+            arena_emit(arena, t, la);
+        }
+        return;
+    }
 
-    // 3. Splitter Logic
+    // 4. Splitter Logic: classify once, then walk the masks
+    size_t first_token = arena->count;
+    SegMasks masks;
+    seg_classify((const uint8_t *)src + offset, len, &masks);
     int start = 0;
-    float entropy_threshold = 5.0f; 
     int tokens_emitted = 0;
 
     for (int i = 0; i < len; i++) {
-        uint8_t cur = (uint8_t)src[offset + i];
-        
         // A. Hard Split: Underscore
-        if (cur == '_') {
+        if (seg_bit(masks.under, i)) {
             if (i > start) {
                 NSET_Token t = {0};
                 t.root_id = murmur_hash(src + offset + start, i-start);
                 t.offset = offset + start; t.length = i-start;
-                t.meta.casing = get_casing(src + offset + start, i-start);
+                t.meta.casing = seg_casing(&masks, start, i-start);
                 t.meta.depth = depth;
                 t.meta.pre_space = (tokens_emitted == 0) ? pre_space : 0;
-                arena_push(arena, t, src, file_size);
+                arena_push(arena, t, la);
                 tokens_emitted++;
             }
             // Mark previous token as having joiner
-            if (tokens_emitted > 0) arena->tokens[arena->count - 1].meta.has_joiner = 1;
+            if (tokens_emitted > 0) arena_meta(arena, arena->count - 1)->has_joiner = 1;
             start = i + 1;
             continue;
         }
 
-        // B. Soft Split: Entropy or CamelCase
+        // B. Soft Split: CamelCase or Entropy
         if (i < len - 1) {
-            uint8_t next = (uint8_t)src[offset + i + 1];
-            bool split = false;
-            
             // CamelCase Check
-            if (islower(cur) && isupper(next)) split = true;
-            // Entropy Check (Renamed from get_entropy to match header)
-            else if (calculate_surprise(&global_model, cur, next) > entropy_threshold) {
+            bool split = seg_camel(&masks, i);
+            if (!split) {
                 int left_len = (i + 1) - start;
                 int right_len = len - (i + 1);
-                
-                // Safety: Don't split if it breaks a locked word or creates tiny fragments
-                if (is_word_locked(src + offset + start, left_len)) split = true;
-                else if (left_len >= 4 && right_len >= 3) split = true;
+                // Safety: Don't split if it creates tiny fragments, unless the left
+                // side is a locked word. Positions that can pass neither gate never
+                // consult the model.
+                bool sized = (left_len >= 4 && right_len >= 3);
+                if ((sized || left_len <= locked_words.max_len) &&
+                    model_should_split(model, (uint8_t)src[offset + i], (uint8_t)src[offset + i + 1])) {
+                    split = sized || is_word_locked(src + offset + start, left_len);
+                }
             }
 
             if (split) {
                 NSET_Token t = {0};
                 t.root_id = murmur_hash(src + offset + start, (i+1)-start);
                 t.offset = offset + start; t.length = (i+1)-start;
-                t.meta.casing = get_casing(src + offset + start, (i+1)-start);
+                t.meta.casing = seg_casing(&masks, start, (i+1)-start);
                 t.meta.depth = depth;
                 t.meta.pre_space = (tokens_emitted == 0) ? pre_space : 0;
-                arena_push(arena, t, src, file_size);
+                arena_push(arena, t, la);
                 tokens_emitted++;
                 start = i + 1;
             }
@@ -249,139 +201,810 @@ void process_identifier(Arena *arena, const char *src, int offset, int len, int
         NSET_Token t = {0};
         t.root_id = murmur_hash(src + offset + start, len-start);
         t.offset = offset + start; t.length = len-start;
-        t.meta.casing = get_casing(src + offset + start, len-start);
+        t.meta.casing = seg_casing(&masks, start, len-start);
         t.meta.depth = depth;
         t.meta.pre_space = (tokens_emitted == 0) ? pre_space : 0;
-        arena_push(arena, t, src, file_size);
+        arena_push(arena, t, la);
+    }
+
+    // 5. Remember the split for the next occurrence
+    MemoEntry *e = memo ? memo_begin_fill(memo, model, src + offset, len) : NULL;
+    if (e) {
+        size_t pieces = arena->count - first_token;
+        if (pieces > MEMO_MAX_PIECES) { e->generation = 0; return; }
+        for (size_t p = 0; p < pieces; p++) {
+            NSET_Token t = arena_get(arena, first_token + p);
+            MemoPiece piece = { t.root_id, t.offset - offset, t.length, t.meta.casing, t.meta.has_joiner };
+            e->pieces[p] = piece;
+        }
+        e->n_pieces = pieces;
     }
 }
 
 // ==========================================
-// MAIN LOOP
+// WORD SPLITTER
 // ==========================================
-extern const TSLanguage *tree_sitter_c();
-
-int main(int argc, char **argv) {
-    if (argc < 2) {
-        printf("Usage: %s <file.c>\n", argv[0]);
-        return 1;
+// Comments, strings, preprocessor leaves and macro blobs: every run of
+// non-delimiter bytes becomes one word token (type 1).
+void process_words(Arena *arena, const char *src, int offset, int len, int depth, const Lookahead *la) {
+    uint64_t delim[SEG_MAX_WORDS];
+    seg_delimiters((const uint8_t *)src + offset, len, delim);
+    int pos = 0, start, end;
+    while (seg_next_word(delim, len, &pos, &start, &end)) {
+        NSET_Token t = {0};
+        t.root_id = murmur_hash(src + offset + start, end - start);
+        t.offset = offset + start; t.length = end - start;
+        t.meta.depth = depth;
+        t.meta.type = 1;
+        arena_push(arena, t, la);
     }
+}
 
-    init_registry();
-    load_registry();
-
-    vocab_file = fopen("nset_vocab.bin", "ab");
-    if (!vocab_file) return 1;
+// ==========================================
+// FILE TOKENIZER
+// ==========================================
+extern const TSLanguage *tree_sitter_c();
 
-    // Pre-Train
-    int vocab_size = sizeof(LOCKED_VOCAB)/sizeof(char*);
-    for(int n=0; n<20; n++) for(int i=0; i<vocab_size; i++) 
-        model_train_sequence(&global_model, LOCKED_VOCAB[i], strlen(LOCKED_VOCAB[i]));
+typedef struct {
+    ParseArena parse;     // Tree-sitter memory for the file being parsed
+    EntropyModel model;   // Private copy, reset from base_model per file
+    MemoCache memo;       // Identifier splits, validated against `model`
+    LeafSpans leaves;     // Phase-one leaf buffer, reused across files
+    Arena tokens;         // Output of the current file, reused across files
+    PackBuffer packed;    // The file's packed run for -o (STREAM_PACKED)
+    Lookahead look;       // Absorption maps of the current file
+    RangeSplit split;     // Phase 2 of a big file, cut into ranges
+    uint64_t reserved_tokens; // Emitted with a reserved id (reserved.h)
+    EntropyModel *learned; // Shard: counts learned since the last fold (--model-out)
+    int pending_files;     // Files counted into the shard
+    uint64_t pending_bytes;
+} Worker;
 
-    int fd = open(argv[1], O_RDONLY);
+typedef struct {
+    const char *path;
+    uint64_t size;
+    size_t tokens;
+    bool failed;
+} FileJob;
+
+// Maps a source file read-only. Returns NULL for empty files (*ok = true)
+// and for errors (*ok = false, reported on stderr).
+const char *map_source(const char *path, size_t *size, bool *ok) {
+    *ok = false;
+    int fd = open(path, O_RDONLY);
     if (fd < 0) {
-        perror("Error opening file");
-        return 1;
+        fprintf(stderr, "Error opening file %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    struct stat sb;
+    if (fstat(fd, &sb) != 0) {
+        fprintf(stderr, "Error reading file %s: %s\n", path, strerror(errno));
+        close(fd);
+        return NULL;
     }
-    struct stat sb; fstat(fd, &sb);
+    if (sb.st_size == 0) { close(fd); *ok = true; return NULL; }
     const char *code = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (code == MAP_FAILED) {
+        fprintf(stderr, "Error mapping file %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    *size = sb.st_size;
+    *ok = true;
+    return code;
+}
 
+// ==========================================
+// MODEL TRAINING
+// ==========================================
+// Workers count into private shards (Worker.learned) with no sharing at
+// all. Every `merge_every` files a worker folds its shard into the
+// published model under one short lock, which is also the epoch at
+// which --model-out is checkpointed.
+typedef struct {
+    EntropyModel *published;   // Base + every folded shard
+    pthread_mutex_t lock;
+    const char *path;          // Checkpoint/output file (--model-out)
+    uint64_t files, bytes;     // Corpus folded so far (including the base's)
+    int merge_every;
+    uint64_t epochs;
+} ModelTrainer;
+
+ModelTrainer trainer = { .merge_every = 256 };
+
+bool model_trainer_save() {
+    model_rebuild(trainer.published);
+    if (model_snapshot_save(trainer.path, trainer.published, trainer.files, trainer.bytes)) return true;
+    fprintf(stderr, "Error writing model %s: %s\n", trainer.path, strerror(errno));
+    return false;
+}
+
+void model_trainer_fold(Worker *w, bool checkpoint) {
+    if (w->pending_files == 0) return;
+    pthread_mutex_lock(&trainer.lock);
+    model_merge(trainer.published, w->learned);
+    trainer.files += w->pending_files;
+    trainer.bytes += w->pending_bytes;
+    trainer.epochs++;
+    if (checkpoint && trainer.path) model_trainer_save();
+    pthread_mutex_unlock(&trainer.lock);
+    memset(w->learned, 0, sizeof(EntropyModel));
+    w->pending_files = 0;
+    w->pending_bytes = 0;
+}
+
+// Folds every shard and writes the result to --model-out, if given.
+// The decision bits are rebuilt either way: --two-pass freezes this model.
+void model_trainer_finish(Worker *workers, int n_workers) {
+    for (int w = 0; w < n_workers; w++) model_trainer_fold(&workers[w], false);
+    model_rebuild(trainer.published);
+    if (trainer.path && model_trainer_save())
+        printf(">> Saved model %s (trained on %lu files, %lu epochs).\n", trainer.path,
+               (unsigned long)trainer.files, (unsigned long)trainer.epochs);
+}
+
+void model_trainer_file_done(Worker *w, size_t bytes) {
+    if (!w->learned) return;
+    w->pending_files++;
+    w->pending_bytes += bytes;
+    if (w->pending_files >= trainer.merge_every) model_trainer_fold(w, true);
+}
+
+// Parses a file inside the worker's parse arena. The parser and the tree
+// are scratch for this file only: parse_end() releases both at once.
+TSTree *parse_begin(Worker *w, const char *code, size_t size) {
+    parse_arena_begin(&w->parse);
+    TSParser *parser = ts_parser_new();
+    ts_parser_set_language(parser, tree_sitter_c());
+    return ts_parser_parse_string(parser, NULL, code, size);
+}
+
+// Same, pulling the source through `input` (see ring.h).
+TSTree *parse_begin_input(Worker *w, TSInput input) {
+    parse_arena_begin(&w->parse);
     TSParser *parser = ts_parser_new();
     ts_parser_set_language(parser, tree_sitter_c());
-    TSTree *tree = ts_parser_parse_string(parser, NULL, code, sb.st_size);
-    TSNode root = ts_tree_root_node(tree);
+    return ts_parser_parse(parser, NULL, input);
+}
 
-    Arena arena;
-    arena.tokens = malloc(sb.st_size * sizeof(NSET_Token));
-    arena.count = 0; arena.capacity = sb.st_size;
+void parse_end(Worker *w) {
+    parse_arena_end(&w->parse);
+}
 
-    TSTreeCursor cursor = ts_tree_cursor_new(root);
-    bool visited_children = false;
-    int depth = 0;
+// Training pass for one file: counts identifier bigrams into the worker's
+// shard. Nothing is split, emitted or registered.
+bool train_file(Worker *w, const char *path) {
+    size_t file_size;
+    bool ok;
+    const char *code = map_source(path, &file_size, &ok);
+    if (!code) return ok;
 
+    TSTree *tree = parse_begin(w, code, file_size);
+    TSTreeCursor cursor = ts_tree_cursor_new(ts_tree_root_node(tree));
     for (;;) {
         TSNode node = ts_tree_cursor_current_node(&cursor);
-        if (ts_node_child_count(node) == 0) {
+        if (ts_node_child_count(node) == 0 &&
+            dispatch_class(&node_dispatch, ts_node_symbol(node)) == NODE_IDENTIFIER) {
             uint32_t start = ts_node_start_byte(node);
-            uint32_t end = ts_node_end_byte(node);
-            uint16_t len = end - start;
-            const char *type = ts_node_type(node);
-            bool pre_space = (start > 0 && isspace(code[start-1]) && code[start-1]!='\n');
-            bool pre_break = (start > 0 && code[start-1] == '\n');
-            
-            if (len > 0) {
-                bool already_eaten = false;
-                if (arena.count > 0) {
-                    NSET_Token *prev = &arena.tokens[arena.count-1];
-                    char first_char = code[start];
-                    if (first_char == ';' && prev->meta.has_semi) already_eaten = true;
-                    if (first_char == ',' && prev->meta.has_comma) already_eaten = true;
-                    if (first_char == '(' && prev->meta.has_paren) already_eaten = true;
-                    if (first_char == ')' && prev->meta.has_close) already_eaten = true;
-                    if (first_char == '*' && prev->meta.has_star) already_eaten = true;
-                }
+            model_count_sequence(w->learned, code + start, ts_node_end_byte(node) - start);
+        }
+        if (ts_tree_cursor_goto_first_child(&cursor)) continue;
+        if (ts_tree_cursor_goto_next_sibling(&cursor)) continue;
+        bool more = false;
+        while (ts_tree_cursor_goto_parent(&cursor))
+            if ((more = ts_tree_cursor_goto_next_sibling(&cursor))) break;
+        if (!more) break;
+    }
+    ts_tree_cursor_delete(&cursor);
+    parse_end(w);
+    munmap((void*)code, file_size);
+    model_trainer_file_done(w, file_size);
+    return true;
+}
 
-                if (!already_eaten) {
-                    bool is_preproc = (strncmp(type, "preproc", 7) == 0);
-                    bool is_macro_blob = (len > 32 && !is_word_locked(code+start, len));
+// The leaf loop of phase 2 over leaves [first, last), emitting into `arena`.
+void tokenize_range(Arena *arena, MemoCache *memo, const LeafSpans *leaves, const Lookahead *la, const char *code,
+                    uint32_t first, uint32_t last, const EntropyModel *model, EntropyModel *learn) {
+    for (uint32_t leaf = first; leaf < last; leaf++) {
+        uint32_t start = leaves->start[leaf];
+        uint32_t end = leaves->end[leaf];
+        uint16_t len = end - start;
+        TSSymbol sym = leaves->symbol[leaf];
+        NodeClass cls = (NodeClass)leaves->cls[leaf];
+        uint8_t depth = leaves->depth[leaf];
+        bool pre_space = (start > 0 && cc_is_space(code[start-1]) && code[start-1]!='\n');
+        bool pre_break = (start > 0 && code[start-1] == '\n');
+        
+        if (len > 0) {
+            // Absorbed by the token before it: that token ends right in front
+            bool already_eaten = false;
+            if (arena->count > 0 && lookahead_marked(la, start)) {
+                NSET_Token prev = arena_get(arena, arena->count-1);
+                already_eaten = lookahead_eaten(la, prev.offset + prev.length, start);
+            }
 
-                    if (strstr(type, "identifier")) {
-                         process_identifier(&arena, code, start, len, depth%7, pre_space, sb.st_size);
-                    }
-                    else if (strcmp(type, "comment") == 0 || strcmp(type, "string_literal") == 0 || is_preproc || is_macro_blob) {
-                        int sub_start = 0;
-                        for(int i=0; i<len; i++) {
-                            char c = code[start + i];
-                            if (isspace(c) || ispunct(c)) {
-                                if (i > sub_start) {
-                                    int sub_len = i - sub_start;
-                                    NSET_Token t = {0};
-                                    t.root_id = murmur_hash(code + start + sub_start, sub_len);
-                                    t.offset = start + sub_start; t.length = sub_len;
-                                    t.meta.depth = depth%7;
-                                    t.meta.type = 1; 
-                                    arena_push(&arena, t, code, sb.st_size);
-                                }
-                                sub_start = i + 1;
-                            }
-                        }
-                        if (sub_start < len) {
-                            NSET_Token t = {0};
-                            t.root_id = murmur_hash(code + start + sub_start, len - sub_start);
-                            t.offset = start + sub_start; t.length = len - sub_start;
-                            t.meta.type = 1;
-                            arena_push(&arena, t, code, sb.st_size);
-                        }
-                    }
-                    else {
-                        NSET_Token t = {0};
+            if (!already_eaten) {
+                bool is_macro_blob = (len > 32 && !is_word_locked(code+start, len));
+
+                if (cls == NODE_IDENTIFIER) {
+                     process_identifier(arena, model, learn, memo, code, start, len, depth, pre_space, la);
+                }
+                // Comments, strings and preprocessor leaves are split into words
+                else if (cls != NODE_OTHER || is_macro_blob) {
+                    process_words(arena, code, start, len, depth, la);
+                }
+                else {
+                    NSET_Token t = {0};
+                    uint16_t reserved = dispatch_reserved(&node_dispatch, sym, code + start, len);
+                    t.offset = start; t.length = len;
+                    t.meta.depth = depth; 
+                    t.meta.pre_space = pre_space;
+                    t.meta.pre_break = pre_break;
+                    if (reserved) {
+                        // Keywords, types and operators: fixed id, nothing to register
+                        t.root_id = reserved;
+                        arena_emit(arena, t, la);
+                    } else {
                         t.root_id = murmur_hash(code + start, len);
-                        t.offset = start; t.length = len;
-                        t.meta.depth = depth%7; 
-                        t.meta.pre_space = pre_space;
-                        t.meta.pre_break = pre_break;
-                        if (isdigit(code[start])) t.meta.type = 2;
-                        arena_push(&arena, t, code, sb.st_size);
+                        if (cc_is_digit(code[start])) t.meta.type = 2;
+                        arena_push(arena, t, la);
                     }
                 }
             }
         }
-        if (ts_tree_cursor_goto_first_child(&cursor)) { visited_children=false; depth++; }
-        else if (ts_tree_cursor_goto_next_sibling(&cursor)) { visited_children=false; }
-        else { 
-            do { if (!ts_tree_cursor_goto_parent(&cursor)) goto done; depth--; } 
-            while (!ts_tree_cursor_goto_next_sibling(&cursor)); 
-            visited_children=false; 
+    }
+}
+
+typedef struct {
+    RangeSplit *split;
+    const LeafSpans *leaves;
+    const Lookahead *la;
+    const char *code;
+    const EntropyModel *frozen;  // Shared by every range, or NULL: each one learns
+} RangeJobs;
+
+void run_count_job(void *worker, uint32_t job, void *shared) {
+    (void)worker;
+    RangeJobs *j = shared;
+    ranges_count(j->split, job, j->leaves, j->code);
+}
+
+// `worker` is the file's own worker or an idle one lent by the pool;
+// either way its memo cache is not in use.
+void run_range_job(void *worker, uint32_t job, void *shared) {
+    RangeJobs *j = shared;
+    LeafRange *r = &j->split->ranges[job];
+    EntropyModel *learn = j->frozen ? NULL : r->model;
+    if (job > 0) arena_reset(r->tokens);
+    tokenize_range(r->tokens, &((Worker *)worker)->memo, j->leaves, j->la, j->code, r->first, r->last,
+                   j->frozen ? j->frozen : learn, learn);
+}
+
+// Phase 2 of a planned file, one range per job: count, give every range
+// its starting model, tokenize, stitch into w->tokens. `learn` ends up
+// where a single pass would leave it. Both passes go through the range
+// board, so they run on this worker plus whichever workers are idle.
+void tokenize_ranges(Worker *w, const char *code, const EntropyModel *model, EntropyModel *learn) {
+    RangeSplit *rs = &w->split;
+    RangeJobs jobs = { rs, &w->leaves, &w->look, code, learn ? NULL : model };
+    if (learn) {
+        range_board_run(&range_board, run_count_job, &jobs, rs->count, w);
+        ranges_prefix(rs, learn);
+    }
+    range_board_run(&range_board, run_range_job, &jobs, rs->count, w);
+    ranges_stitch(rs);
+    if (learn) model_copy(learn, rs->ranges[rs->count - 1].model);
+}
+
+// Phase 2 of a parsed buffer: classifies the leaves in w->leaves, marks
+// the absorbable symbols, then splits and emits into w->tokens (range by
+// range, with idle workers helping, when the buffer is big enough).
+void tokenize_leaves(Worker *w, const char *code, size_t size, const EntropyModel *model, EntropyModel *learn) {
+    LeafSpans *leaves = &w->leaves;
+    Lookahead *la = &w->look;
+    lookahead_build(la, code, size);
+    for (uint32_t i = 0; i < leaves->count; i++) {
+        leaves->cls[i] = dispatch_class(&node_dispatch, leaves->symbol[i]);
+        if (leaves->cls[i] == NODE_OTHER) lookahead_mark_leaf(la, leaves->start[i], leaves->end[i]);
+    }
+
+    Arena *arena = &w->tokens;
+    arena_reset(arena);
+    if (range_bytes > 0 && range_threads > 1 && size >= 2 * range_bytes &&
+        ranges_plan(&w->split, leaves, la, range_bytes, arena) > 1)
+        tokenize_ranges(w, code, model, learn);
+    else
+        tokenize_range(arena, &w->memo, leaves, la, code, 0, leaves->count, model, learn);
+}
+
+// Writes w->tokens to the -o stream as the next part of `run`: the whole
+// run of a file (`first`), or one more segment of a streamed input. `st`
+// carries the packing state from part to part.
+void write_tokens(Worker *w, size_t file, StreamRun *run, PackState *st, bool first) {
+    Arena *arena = &w->tokens;
+    bool packed = token_stream.encoding == STREAM_PACKED;
+    if (packed) pack_arena(&w->packed, arena, st);
+    uint64_t records = packed ? w->packed.count : arena->count;
+    if (first) *run = stream_begin_file(&token_stream, file, arena->count, records);
+    else stream_extend_file(&token_stream, run, arena->count, records);
+    if (packed) {
+        stream_append(&token_stream, run, w->packed.words, w->packed.count);
+        return;
+    }
+    for (size_t c = 0; c < arena_chunks_used(arena); c++) {
+        size_t n;
+        const NSET_Token *chunk = arena_records(arena, c, &n);
+        stream_append(&token_stream, run, chunk, n);
+    }
+}
+
+// Tokenizes one file (input number `file`). Every file starts from the
+// pre-trained model, so the result does not depend on which worker runs
+// it or in what order.
+bool tokenize_file(Worker *w, const char *path, size_t file, size_t *token_count) {
+    *token_count = 0;
+    size_t file_size;
+    bool ok;
+    const char *code = map_source(path, &file_size, &ok);
+    if (!code) return ok;
+
+    // Online mode: a private copy that learns as it goes. Frozen: read-only.
+    const EntropyModel *model = frozen_model;
+    EntropyModel *learn = NULL;
+    if (!model) {
+        model_copy(&w->model, base_model);
+        model = learn = &w->model;
+    }
+
+    // Phase 1: flatten the leaves, then drop the tree before any splitting
+    TSTree *tree = parse_begin(w, code, file_size);
+    leaves_collect(&w->leaves, tree);
+    parse_end(w);
+
+    // Phase 2: split and emit
+    tokenize_leaves(w, code, file_size, model, learn);
+
+    Arena *arena = &w->tokens;
+    if (w->learned && learn) model_accumulate(w->learned, learn, base_model);
+    *token_count = arena->count;
+    w->reserved_tokens += arena_count_ids_below(arena, NSET_RESERVED_IDS);
+    if (token_stream.fd >= 0) {
+        StreamRun run;
+        PackState st = {0};
+        write_tokens(w, file, &run, &st, true);
+        stream_end_file(&token_stream, &run);
+    }
+    munmap((void*)code, file_size);
+    model_trainer_file_done(w, file_size);
+    return true;
+}
+
+// Tokenizes input that cannot be mapped (stdin, a pipe) segment by
+// segment through an InputRing, so memory stays bounded however long the
+// stream is. The model learns across the whole stream, as for one file.
+bool tokenize_stream(Worker *w, int fd, size_t file, size_t *token_count, uint64_t *bytes) {
+    *token_count = 0;
+    InputRing ring;
+    if (!ring_init(&ring, fd, stdin_ring_size)) {
+        fprintf(stderr, "Error mapping the input ring: %s\n", strerror(errno));
+        return false;
+    }
+
+    const EntropyModel *model = frozen_model;
+    EntropyModel *learn = NULL;
+    if (!model) {
+        model_copy(&w->model, base_model);
+        model = learn = &w->model;
+    }
+
+    StreamRun run;
+    PackState st = {0};
+    Arena *arena = &w->tokens;
+    while (ring_next(&ring)) {
+        TSTree *tree = parse_begin_input(w, ring_input(&ring));
+        leaves_collect(&w->leaves, tree);
+        parse_end(w);
+
+        size_t size;
+        const char *code = ring_segment(&ring, &size);
+        tokenize_leaves(w, code, size, model, learn);
+        arena_shift(arena, (uint32_t)ring.head);
+        *token_count += arena->count;
+        w->reserved_tokens += arena_count_ids_below(arena, NSET_RESERVED_IDS);
+        if (token_stream.fd >= 0) write_tokens(w, file, &run, &st, ring.segments == 1);
+    }
+    if (ring.error) fprintf(stderr, "Error reading stdin: %s\n", strerror(ring.error));
+    if (token_stream.fd >= 0) {
+        if (ring.segments > 0) stream_end_file(&token_stream, &run);
+        stream_set_source_size(&token_stream, file, ring.tail);
+    }
+    printf(">> Read %lu bytes from stdin in %lu segments (%lu cut without a boundary), %lu MB ring.\n",
+           (unsigned long)ring.tail, (unsigned long)ring.segments, (unsigned long)ring.forced,
+           (unsigned long)(ring.cap >> 20));
+
+    if (w->learned && learn) model_accumulate(w->learned, learn, base_model);
+    model_trainer_file_done(w, ring.tail);
+    *bytes = ring.tail;
+    ring_free(&ring);
+    return ring.error == 0;
+}
+
+void run_file_job(void *worker, size_t job, void *shared) {
+    FileJob *jobs = shared;
+    if (strcmp(jobs[job].path, "-") == 0)
+        jobs[job].failed = !tokenize_stream(worker, STDIN_FILENO, job, &jobs[job].tokens, &jobs[job].size);
+    else
+        jobs[job].failed = !tokenize_file(worker, jobs[job].path, job, &jobs[job].tokens);
+    if (jobs[job].failed && token_stream.fd >= 0) stream_fail_file(&token_stream, job);
+    range_board_file_done(&range_board);
+}
+
+// Idle hook of the file pool: a worker with no file left runs range jobs
+bool run_idle_ranges(void *worker, void *shared) {
+    (void)shared;
+    return range_board_help(&range_board, worker);
+}
+
+void run_train_job(void *worker, size_t job, void *shared) {
+    FileJob *jobs = shared;
+    jobs[job].failed = !train_file(worker, jobs[job].path);
+}
+
+// ==========================================
+// INPUT COLLECTION
+// ==========================================
+// Arguments may be files, directories (walked recursively for .c/.h),
+// @list files holding one path per line, or - for stdin.
+typedef struct {
+    FileJob *items;
+    size_t count;
+    size_t capacity;
+} FileList;
+
+void file_list_add(FileList *list, const char *path, uint64_t size) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 64;
+        list->items = realloc(list->items, list->capacity * sizeof(FileJob));
+    }
+    FileJob job = { .path = strdup(path), .size = size };
+    list->items[list->count++] = job;
+}
+
+bool is_c_source(const char *name) {
+    const char *dot = strrchr(name, '.');
+    return dot && (strcmp(dot, ".c") == 0 || strcmp(dot, ".h") == 0);
+}
+
+int name_cmp(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+void collect_path(FileList *list, const char *path, bool explicit);
+
+void collect_dir(FileList *list, const char *dir) {
+    DIR *d = opendir(dir);
+    if (!d) { fprintf(stderr, "Error opening directory %s: %s\n", dir, strerror(errno)); return; }
+
+    // Sorted walk, so the input order (and the report) is reproducible
+    char **names = NULL;
+    size_t n = 0, cap = 0;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        if (e->d_name[0] == '.') continue; // Skip hidden entries, "." and ".."
+        if (n == cap) { cap = cap ? cap * 2 : 32; names = realloc(names, cap * sizeof(char *)); }
+        names[n++] = strdup(e->d_name);
+    }
+    closedir(d);
+    qsort(names, n, sizeof(char *), name_cmp);
+
+    char path[4096];
+    for (size_t i = 0; i < n; i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+        collect_path(list, path, false);
+        free(names[i]);
+    }
+    free(names);
+}
+
+void collect_list(FileList *list, const char *list_path) {
+    FILE *f = fopen(list_path, "r");
+    if (!f) { fprintf(stderr, "Error opening list %s: %s\n", list_path, strerror(errno)); return; }
+    char line[4096];
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] != '\0') collect_path(list, line, true);
+    }
+    fclose(f);
+}
+
+void collect_path(FileList *list, const char *path, bool explicit) {
+    if (explicit && path[0] == '@') { collect_list(list, path + 1); return; }
+    if (explicit && strcmp(path, "-") == 0) { file_list_add(list, path, 0); return; }
+    struct stat sb;
+    if (stat(path, &sb) != 0) {
+        fprintf(stderr, "Error opening file %s: %s\n", path, strerror(errno));
+        return;
+    }
+    if (S_ISDIR(sb.st_mode)) collect_dir(list, path);
+    else if (S_ISREG(sb.st_mode) && (explicit || is_c_source(path))) file_list_add(list, path, sb.st_size);
+}
+
+// ==========================================
+// MAIN
+// ==========================================
+int main(int argc, char **argv) {
+    int n_threads = 0;
+    double load_factor = 0;
+    JournalFsync fsync_policy = JOURNAL_FSYNC_CLOSE;
+    const char *model_in = NULL, *model_out = NULL;
+    const char *locked_path = NULL, *stream_path = NULL;
+    bool train_only = false, two_pass = false, huge_pages = false;
+    uint16_t stream_encoding = STREAM_PACKED;
+    int argi = 1;
+    while (argi < argc && argv[argi][0] == '-' && argv[argi][1] != '\0') {
+        if (strcmp(argv[argi], "-j") == 0 && argi + 1 < argc) { n_threads = atoi(argv[argi + 1]); argi += 2; }
+        else if (strncmp(argv[argi], "-j", 2) == 0) { n_threads = atoi(argv[argi] + 2); argi++; }
+        else if (strcmp(argv[argi], "--load-factor") == 0 && argi + 1 < argc) { load_factor = atof(argv[argi + 1]); argi += 2; }
+        else if (strcmp(argv[argi], "--fsync") == 0 && argi + 1 < argc) {
+            if (!journal_parse_fsync(argv[argi + 1], &fsync_policy)) {
+                fprintf(stderr, "Error: --fsync expects none, close or batch\n");
+                return 1;
+            }
+            argi += 2;
+        }
+        else if (strcmp(argv[argi], "--model-in") == 0 && argi + 1 < argc) { model_in = argv[argi + 1]; argi += 2; }
+        else if (strcmp(argv[argi], "--model-out") == 0 && argi + 1 < argc) { model_out = argv[argi + 1]; argi += 2; }
+        else if (strcmp(argv[argi], "--merge-every") == 0 && argi + 1 < argc) { trainer.merge_every = atoi(argv[argi + 1]); argi += 2; }
+        else if (strcmp(argv[argi], "--train") == 0) { train_only = true; argi++; }
+        else if (strcmp(argv[argi], "--two-pass") == 0) { two_pass = true; argi++; }
+        else if (strcmp(argv[argi], "--locked-words") == 0 && argi + 1 < argc) { locked_path = argv[argi + 1]; argi += 2; }
+        else if (strcmp(argv[argi], "--huge-pages") == 0) { huge_pages = true; argi++; }
+        else if (strcmp(argv[argi], "--stdin-buffer") == 0 && argi + 1 < argc) {
+            stdin_ring_size = (size_t)atoi(argv[argi + 1]) << 20;
+            if (stdin_ring_size == 0) {
+                fprintf(stderr, "Error: --stdin-buffer expects a size in MB\n");
+                return 1;
+            }
+            argi += 2;
+        }
+        else if (strcmp(argv[argi], "--range-size") == 0 && argi + 1 < argc) {
+            int mb = atoi(argv[argi + 1]);
+            if (mb < 0) {
+                fprintf(stderr, "Error: --range-size expects a size in MB (0 to turn ranges off)\n");
+                return 1;
+            }
+            range_bytes = (uint64_t)mb << 20;
+            argi += 2;
+        }
+        else if (strcmp(argv[argi], "-o") == 0 && argi + 1 < argc) { stream_path = argv[argi + 1]; argi += 2; }
+        else if (strcmp(argv[argi], "--stream-format") == 0 && argi + 1 < argc) {
+            if (strcmp(argv[argi + 1], "packed") == 0) stream_encoding = STREAM_PACKED;
+            else if (strcmp(argv[argi + 1], "records") == 0) stream_encoding = STREAM_RECORDS;
+            else {
+                fprintf(stderr, "Error: --stream-format expects packed or records\n");
+                return 1;
+            }
+            argi += 2;
         }
+        else break;
     }
+    if (argi >= argc) {
+        printf("Usage: %s [-j threads] [--load-factor f] [--fsync none|close|batch]\n"
+               "       [--model-in model.bin] [--model-out model.bin] [--train | --two-pass] [--merge-every files]\n"
+               "       [--locked-words words.txt] [-o tokens.nset] [--stream-format packed|records]\n"
+               "       [--huge-pages] [--stdin-buffer MB] [--range-size MB]\n"
+               "       <file.c | dir | @list | ->...\n", argv[0]);
+        return 1;
+    }
+
+    if (train_only && !model_out) {
+        fprintf(stderr, "Error: --train needs --model-out\n");
+        return 1;
+    }
+    if (train_only && two_pass) {
+        fprintf(stderr, "Error: --train and --two-pass are exclusive\n");
+        return 1;
+    }
+    if (train_only && stream_path) {
+        fprintf(stderr, "Error: --train produces no tokens for -o\n");
+        return 1;
+    }
+    bool learning = model_out || two_pass;
+    if (trainer.merge_every < 1) trainer.merge_every = 1;
 
-done:
-    if (vocab_file) fclose(vocab_file);
-    free(seen_hashes);
-    free(arena.tokens);
-    ts_tree_delete(tree);
-    ts_parser_delete(parser);
-    munmap((void*)code, sb.st_size);
-    printf(">> Tokenization Complete.\n");
-    return 0;
+    FileList inputs = {0};
+    for (int i = argi; i < argc; i++) collect_path(&inputs, argv[i], true);
+    if (inputs.count == 0) {
+        fprintf(stderr, "Error: no input files\n");
+        return 1;
+    }
+    for (size_t i = 0; i < inputs.count; i++) {
+        if (strcmp(inputs.items[i].path, "-") != 0) continue;
+        // A pipe is read once, by one worker, and its run must be the only one open
+        if (inputs.count > 1 || train_only || two_pass) {
+            fprintf(stderr, "Error: - (stdin) must be the only input and cannot be used with --train or --two-pass\n");
+            return 1;
+        }
+    }
+
+    // Pre-Train (a snapshot already holds trained statistics)
+    int vocab_size = sizeof(LOCKED_VOCAB)/sizeof(char*);
+    ModelSnapshot snapshot = {0};
+    if (model_in) {
+        if (!model_snapshot_map(model_in, &snapshot)) return 1;
+        base_model = snapshot.model;
+        printf(">> Loaded model %s (trained on %lu files).\n", model_in, (unsigned long)snapshot.header.trained_files);
+    } else {
+        for(int n=0; n<20; n++) for(int i=0; i<vocab_size; i++) 
+            model_train_sequence(&seed_model, LOCKED_VOCAB[i], strlen(LOCKED_VOCAB[i]));
+    }
+
+    for(int i=0; i<vocab_size; i++) locked_add(&locked_words, LOCKED_VOCAB[i], strlen(LOCKED_VOCAB[i]));
+    if (locked_path) {
+        int added = locked_load_file(&locked_words, locked_path);
+        if (added < 0) {
+            fprintf(stderr, "Error opening locked word file %s: %s\n", locked_path, strerror(errno));
+            return 1;
+        }
+        printf(">> Loaded %d locked words from %s.\n", added, locked_path);
+    }
+    locked_build(&locked_words);
+    dispatch_init(&node_dispatch, tree_sitter_c());
+    parse_arena_install();
+
+    if (learning) {
+        trainer.published = malloc(sizeof(EntropyModel));
+        memcpy(trainer.published, base_model, sizeof(EntropyModel));
+        pthread_mutex_init(&trainer.lock, NULL);
+        trainer.path = model_out;
+        trainer.files = snapshot.header.trained_files;
+        trainer.bytes = snapshot.header.trained_bytes;
+    }
+
+    // A training pass only counts; it never touches the vocabulary
+    if (!train_only) {
+        init_registry(load_factor);
+        load_registry(NSET_VOCAB_PATH);
+        if (!open_vocab_sink(fsync_policy)) {
+            fprintf(stderr, "Error opening %s: %s\n", NSET_VOCAB_PATH, strerror(errno));
+            return 1;
+        }
+    }
+    if (stream_path) {
+        for (size_t i = 0; i < inputs.count; i++) stream_add_file(&token_stream, inputs.items[i].path, inputs.items[i].size);
+        uint16_t record_size = stream_encoding == STREAM_PACKED ? sizeof(NSET_PackedToken) : sizeof(NSET_Token);
+        if (!stream_open(&token_stream, stream_path, stream_encoding, record_size)) {
+            fprintf(stderr, "Error opening %s: %s\n", stream_path, strerror(errno));
+            return 1;
+        }
+    }
+
+    if (n_threads <= 0) n_threads = pool_default_workers();
+    // More workers than files only pay off as range helpers for a big file
+    // (stdin's size is unknown). Those stay in the one pool of n_threads.
+    bool may_split = false;
+    for (size_t i = 0; i < inputs.count && range_bytes > 0 && !train_only; i++)
+        if (strcmp(inputs.items[i].path, "-") == 0 || inputs.items[i].size >= 2 * range_bytes) may_split = true;
+    if ((size_t)n_threads > inputs.count && !may_split) n_threads = inputs.count;
+    range_threads = n_threads;
+
+    Worker *workers = calloc(n_threads, sizeof(Worker));
+    void **worker_ptrs = calloc(n_threads, sizeof(void *));
+    for (int w = 0; w < n_threads; w++) {
+        memo_init(&workers[w].memo);
+        arena_init(&workers[w].tokens, huge_pages);
+        ranges_init(&workers[w].split, huge_pages);
+        if (learning) workers[w].learned = calloc(1, sizeof(EntropyModel));
+        worker_ptrs[w] = &workers[w];
+    }
+
+    uint64_t *weights = malloc(inputs.count * sizeof(uint64_t));
+    for (size_t i = 0; i < inputs.count; i++) weights[i] = inputs.items[i].size;
+    // Pass 1 (--two-pass): count the whole corpus, then freeze the result.
+    // Pass 2 splits every file against that one model, with no writes to it.
+    if (two_pass) {
+        printf(">> Pass 1: counting %lu files on %d threads...\n", inputs.count, n_threads);
+        pool_run(inputs.count, weights, n_threads, worker_ptrs, run_train_job, NULL, inputs.items);
+        model_trainer_finish(workers, n_threads);
+        EntropyModel *frozen = malloc(sizeof(EntropyModel));
+        model_copy(frozen, trainer.published);
+        frozen_model = frozen;
+        for (int w = 0; w < n_threads; w++) { free(workers[w].learned); workers[w].learned = NULL; }
+        printf(">> Pass 2: tokenizing against the frozen model...\n");
+    }
+    else if (inputs.count > 1) printf(">> %s %lu files on %d threads...\n", train_only ? "Training on" : "Tokenizing", inputs.count, n_threads);
+    range_board_init(&range_board, inputs.count);
+    if (train_only) pool_run(inputs.count, weights, n_threads, worker_ptrs, run_train_job, NULL, inputs.items);
+    else pool_run(inputs.count, weights, n_threads, worker_ptrs, run_file_job, run_idle_ranges, inputs.items);
+
+    size_t total_tokens = 0, failed = 0;
+    uint64_t total_bytes = 0;
+    for (size_t i = 0; i < inputs.count; i++) {
+        total_tokens += inputs.items[i].tokens;
+        if (inputs.items[i].failed) failed++;
+        else total_bytes += inputs.items[i].size;
+        free((char *)inputs.items[i].path);
+    }
+
+    // Fold what is left in the shards and save the final model, so the next
+    // run starts where this one ended
+    if (learning) {
+        if (!two_pass) model_trainer_finish(workers, n_threads);
+        free(trainer.published);
+        pthread_mutex_destroy(&trainer.lock);
+    }
+    free((void *)frozen_model);
+
+    MemoCache memo_total = {0};
+    ParseArena parse_total = {0};
+    size_t token_high_water = 0, token_chunks = 0, huge_chunks = 0;
+    uint64_t reserved_tokens = 0, split_count = 0, split_ranges = 0;
+    for (int w = 0; w < n_threads; w++) {
+        Arena *ta = &workers[w].tokens;
+        arena_reset(ta);
+        if (ta->high_water > token_high_water) token_high_water = ta->high_water;
+        token_chunks += ta->n_chunks;
+        huge_chunks += ta->huge_chunks;
+        reserved_tokens += workers[w].reserved_tokens;
+        arena_free(ta);
+        const ParseArena *pa = &workers[w].parse;
+        parse_total.files += pa->files;
+        parse_total.allocs += pa->allocs;
+        parse_total.reused += pa->reused;
+        parse_total.owned_allocs += pa->owned_allocs;
+        parse_total.chunk_mallocs += pa->chunk_mallocs;
+        parse_total.reserved_bytes += pa->reserved_bytes;
+        if (pa->peak_bytes > parse_total.peak_bytes) parse_total.peak_bytes = pa->peak_bytes;
+        if (pa->last_grow_file > parse_total.last_grow_file) parse_total.last_grow_file = pa->last_grow_file;
+        parse_arena_free(&workers[w].parse);
+        memo_total.hits += workers[w].memo.hits;
+        memo_total.misses += workers[w].memo.misses;
+        memo_total.stale += workers[w].memo.stale;
+        memo_total.evictions += workers[w].memo.evictions;
+        memo_total.bypass += workers[w].memo.bypass;
+        memo_free(&workers[w].memo);
+        RangeSplit *rs = &workers[w].split;
+        split_count += rs->splits;
+        split_ranges += rs->total_ranges;
+        for (uint32_t r = 0; r < rs->capacity; r++) {
+            token_chunks += rs->ranges[r].own.n_chunks;
+            huge_chunks += rs->ranges[r].own.huge_chunks;
+        }
+        ranges_free(rs);
+        leaves_free(&workers[w].leaves);
+        pack_buffer_free(&workers[w].packed);
+        lookahead_free(&workers[w].look);
+        free(workers[w].learned);
+    }
+    memo_report(&memo_total);
+    parse_arena_report(&parse_total);
+    if (split_count > 0)
+        printf(">> Intra-file ranges: %lu buffers split into %lu ranges of ~%lu MB, %lu range jobs run by idle workers.\n",
+               (unsigned long)split_count, (unsigned long)split_ranges,
+               (unsigned long)(range_bytes >> 20), (unsigned long)range_board.helped);
+    range_board_free(&range_board);
+    if (!train_only)
+        printf(">> Token arena (%s): high-water %lu tokens/file, %lu chunks of %lu tokens (%lu on huge pages), "
+               "%.1f%% reserved ids.\n", ARENA_LAYOUT,
+               (unsigned long)token_high_water, (unsigned long)token_chunks,
+               (unsigned long)ARENA_CHUNK_TOKENS, (unsigned long)huge_chunks,
+               total_tokens ? 100.0 * reserved_tokens / total_tokens : 0.0);
+    free(workers);
+    free(worker_ptrs);
+    free(weights);
+    free(inputs.items);
+    model_snapshot_unmap(&snapshot);
+    if (train_only) {
+        printf(">> Training Complete. %lu files, %lu bytes.\n", inputs.count - failed, (unsigned long)total_bytes);
+        return failed ? 1 : 0;
+    }
+    close_registry();
+    if (stream_path) {
+        if (stream_close(&token_stream)) printf(">> Wrote %lu tokens to %s.\n", total_tokens, stream_path);
+        else { fprintf(stderr, "Error writing %s: %s\n", stream_path, strerror(errno)); failed++; }
+    }
+    locked_free(&locked_words);
+    dispatch_free(&node_dispatch);
+    printf(">> Tokenization Complete. %lu files, %lu tokens.\n", inputs.count - failed, total_tokens);
+    return failed ? 1 : 0;
 }
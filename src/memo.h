@@ -0,0 +1,115 @@
+/* * NSET v6.0 - Identifier Segmentation Cache
+ * -------------------------------------------------------
+ * Names like `buffer_len` show up thousands of times per file. This
+ * direct-mapped cache remembers, per identifier spelling, where it was
+ * split and the root id / casing / joiner of every piece.
+ *
+ * Validity: a split depends on the model rows of every character but
+ * the last. An entry stores the model generation plus the sum of those
+ * rows' epochs; epochs only grow, so any decision flip in an involved
+ * row changes the sum and the entry is treated as stale.
+ */
+
+#ifndef NSET_MEMO_H
+#define NSET_MEMO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "entropy.h"
+
+#define MEMO_SLOTS      4096    // Power of two
+#define MEMO_MAX_LEN    48      // Longer identifiers bypass the cache
+#define MEMO_MAX_PIECES 8
+
+typedef struct {
+    uint32_t root_id;
+    uint8_t start;
+    uint8_t length;
+    uint8_t casing;
+    uint8_t has_joiner;
+} MemoPiece;
+
+typedef struct {
+    uint64_t generation;    // 0 = empty
+    uint64_t epoch_sum;
+    uint8_t length;
+    uint8_t n_pieces;
+    char key[MEMO_MAX_LEN];
+    MemoPiece pieces[MEMO_MAX_PIECES];
+} MemoEntry;
+
+typedef struct {
+    MemoEntry *entries;
+    uint64_t hits;
+    uint64_t misses;        // Includes stale entries
+    uint64_t stale;
+    uint64_t evictions;
+    uint64_t bypass;
+} MemoCache;
+
+static inline void memo_init(MemoCache *c) {
+    memset(c, 0, sizeof(*c));
+    c->entries = calloc(MEMO_SLOTS, sizeof(MemoEntry));
+}
+
+static inline void memo_free(MemoCache *c) {
+    free(c->entries);
+    c->entries = NULL;
+}
+
+// Case-sensitive: casing is part of what gets cached.
+static inline uint32_t memo_hash(const char *s, int len) {
+    uint32_t h = 0x811c9dc5;
+    for (int i = 0; i < len; i++) { h ^= (uint8_t)s[i]; h *= 0x01000193; }
+    return h;
+}
+
+static inline uint64_t memo_epoch_sum(const EntropyModel *m, const char *s, int len) {
+    uint64_t sum = 0;
+    for (int i = 0; i < len - 1; i++) sum += m->row_epoch[(uint8_t)s[i]];
+    return sum;
+}
+
+// Returns the entry for `s` if it is present and still valid for `m`.
+static inline const MemoEntry *memo_lookup(MemoCache *c, const EntropyModel *m, const char *s, int len) {
+    if (len > MEMO_MAX_LEN) { c->bypass++; return NULL; }
+    MemoEntry *e = &c->entries[memo_hash(s, len) & (MEMO_SLOTS - 1)];
+    if (e->generation == 0 || e->length != len || memcmp(e->key, s, len) != 0) {
+        c->misses++;
+        return NULL;
+    }
+    if (e->generation != m->generation || e->epoch_sum != memo_epoch_sum(m, s, len)) {
+        c->misses++;
+        c->stale++;
+        return NULL;
+    }
+    c->hits++;
+    return e;
+}
+
+// Claims the slot for `s`; the caller fills in the pieces. NULL if uncacheable.
+static inline MemoEntry *memo_begin_fill(MemoCache *c, const EntropyModel *m, const char *s, int len) {
+    if (len > MEMO_MAX_LEN) return NULL;
+    MemoEntry *e = &c->entries[memo_hash(s, len) & (MEMO_SLOTS - 1)];
+    if (e->generation != 0 && (e->length != len || memcmp(e->key, s, len) != 0)) c->evictions++;
+    e->generation = m->generation;
+    e->epoch_sum = memo_epoch_sum(m, s, len);
+    e->length = len;
+    e->n_pieces = 0;
+    memcpy(e->key, s, len);
+    return e;
+}
+
+static inline void memo_report(const MemoCache *c) {
+    uint64_t lookups = c->hits + c->misses;
+    if (lookups == 0) return;
+    printf(">> Memo cache: %.1f%% hit rate (%lu hits, %lu misses, %lu stale, %lu evictions, %lu bypassed).\n",
+           100.0 * c->hits / lookups, (unsigned long)c->hits, (unsigned long)c->misses,
+           (unsigned long)c->stale, (unsigned long)c->evictions, (unsigned long)c->bypass);
+}
+
+#endif
@@ -0,0 +1,134 @@
+/* * NSET v6.0 - Packed Tokens
+ * -------------------------------------------------------
+ * The 8-byte form of NSET_Token, for token streams and anything else
+ * that stores tokens in bulk. One little-endian uint64_t per token:
+ *
+ *   bits  0..31  root_id
+ *   bits 32..47  meta (NSET_Meta, same bit order)
+ *   bits 48..55  length
+ *   bits 56..63  gap: bytes from the end of the previous token
+ *
+ * Offsets are not stored: a token starts `gap` bytes after the previous
+ * one ends, and the first token of a file counts from byte 0. Tokens are
+ * emitted in source order, so the gap is never negative and almost
+ * always small.
+ * Escape: a gap of PACK_ESCAPE means the gap or the length did not fit.
+ * The length byte is then 0 and the next word is an extension record
+ * holding the absolute offset (bits 0..31) and length (bits 32..47).
+ * A run therefore decodes front to back; a file is the unit of random
+ * access.
+ */
+
+#ifndef NSET_PACK_H
+#define NSET_PACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+typedef uint64_t NSET_PackedToken;
+
+#define PACK_ESCAPE 0xFF
+
+_Static_assert(sizeof(NSET_Meta) == sizeof(uint16_t), "meta must pack into 16 bits");
+
+// Carries the end of the previous token between calls; zero it per file.
+typedef struct {
+    uint32_t end;
+} PackState;
+
+static inline uint16_t pack_meta(NSET_Meta m) {
+    uint16_t bits;
+    memcpy(&bits, &m, sizeof(bits));
+    return bits;
+}
+
+static inline NSET_Meta unpack_meta(uint16_t bits) {
+    NSET_Meta m;
+    memcpy(&m, &bits, sizeof(m));
+    return m;
+}
+
+// Encodes n tokens into `out`, which needs room for 2 * n words.
+// Returns the number of words written.
+static inline size_t pack_tokens(PackState *st, const NSET_Token *t, size_t n, NSET_PackedToken *out) {
+    size_t w = 0;
+    uint32_t end = st->end;
+    for (size_t i = 0; i < n; i++) {
+        uint32_t gap = t[i].offset - end;
+        uint64_t word = t[i].root_id | (uint64_t)pack_meta(t[i].meta) << 32;
+        if (gap < PACK_ESCAPE && t[i].length <= 0xFF) {
+            out[w++] = word | (uint64_t)t[i].length << 48 | (uint64_t)gap << 56;
+        } else {
+            out[w++] = word | (uint64_t)PACK_ESCAPE << 56;
+            out[w++] = t[i].offset | (uint64_t)t[i].length << 32;
+        }
+        end = t[i].offset + t[i].length;
+    }
+    st->end = end;
+    return w;
+}
+
+// Decodes `words` words into `out` (room for `words` tokens). Returns the
+// number of tokens; a run must not end inside an escape.
+static inline size_t unpack_tokens(PackState *st, const NSET_PackedToken *in, size_t words, NSET_Token *out) {
+    size_t n = 0;
+    uint32_t end = st->end;
+    for (size_t w = 0; w < words; w++) {
+        uint64_t word = in[w];
+        NSET_Token t;
+        t.root_id = (uint32_t)word;
+        t.meta = unpack_meta((uint16_t)(word >> 32));
+        uint8_t gap = word >> 56;
+        if (gap != PACK_ESCAPE) {
+            t.offset = end + gap;
+            t.length = (uint8_t)(word >> 48);
+        } else {
+            uint64_t ext = in[++w];
+            t.offset = (uint32_t)ext;
+            t.length = (uint16_t)(ext >> 32);
+        }
+        end = t.offset + t.length;
+        out[n++] = t;
+    }
+    st->end = end;
+    return n;
+}
+
+// ==========================================
+// PACK BUFFER
+// ==========================================
+// A file's packed run, built in one go so its size is known before it
+// is written. Reused across files.
+typedef struct {
+    NSET_PackedToken *words;
+    size_t count;
+    size_t capacity;
+} PackBuffer;
+
+// Packs every token of the arena; leaves the run in b->words[0, b->count).
+// `st` is zeroed for a file, or carried over from the previous part.
+static inline void pack_arena(PackBuffer *b, Arena *a, PackState *st) {
+    if (b->capacity < 2 * a->count) {
+        b->capacity = 2 * a->count;
+        free(b->words);
+        b->words = malloc(b->capacity * sizeof(NSET_PackedToken));
+    }
+    b->count = 0;
+    for (size_t c = 0; c < arena_chunks_used(a); c++) {
+        size_t n;
+        const NSET_Token *t = arena_records(a, c, &n);
+        b->count += pack_tokens(st, t, n, b->words + b->count);
+    }
+}
+
+static inline void pack_buffer_free(PackBuffer *b) {
+    free(b->words);
+    b->words = NULL;
+    b->count = b->capacity = 0;
+}
+
+#endif
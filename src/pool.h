@@ -0,0 +1,148 @@
+/* * NSET v6.0 - Work-Stealing Pool
+ * -------------------------------------------------------
+ * Runs N independent jobs across worker threads.
+ * - Jobs are ordered largest-first by weight (file size) and dealt
+ *   round-robin into per-worker deques.
+ * - A worker pops from the front of its own deque (biggest job left)
+ *   and, when empty, steals from the back of a victim (smallest job),
+ *   so the long tail is spread across cores.
+ * Jobs are coarse (whole files), so a mutex per deque is cheap enough.
+ * A drained worker may lend itself out through an idle hook before it
+ * exits (ranges.h runs the ranges of a big file on it).
+ */
+
+#ifndef NSET_POOL_H
+#define NSET_POOL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef void (*pool_job_fn)(void *worker, size_t job, void *shared);
+// Called by a worker with no job left; runs other work if there is some
+// and returns false once there will be none.
+typedef bool (*pool_idle_fn)(void *worker, void *shared);
+
+typedef struct {
+    size_t *jobs;
+    size_t head, tail;        // Live range is [head, tail)
+    pthread_mutex_t lock;
+} PoolDeque;
+
+typedef struct {
+    PoolDeque *deques;
+    int n_workers;
+    void **workers;
+    pool_job_fn fn;
+    pool_idle_fn idle;
+    void *shared;
+} Pool;
+
+typedef struct {
+    Pool *pool;
+    int id;
+} PoolThread;
+
+// The weights go through qsort_r rather than a global, so a pool keeps
+// no state outside pool_run.
+static int pool_weight_cmp(const void *a, const void *b, void *weights) {
+    const uint64_t *w = weights;
+    uint64_t wa = w[*(const size_t *)a];
+    uint64_t wb = w[*(const size_t *)b];
+    if (wa != wb) return (wa < wb) ? 1 : -1;
+    // Stable tie-break keeps the schedule reproducible
+    return (*(const size_t *)a < *(const size_t *)b) ? -1 : 1;
+}
+
+static bool pool_pop(PoolDeque *d, size_t *job) {
+    pthread_mutex_lock(&d->lock);
+    bool ok = d->head < d->tail;
+    if (ok) *job = d->jobs[d->head++];
+    pthread_mutex_unlock(&d->lock);
+    return ok;
+}
+
+static bool pool_steal(PoolDeque *d, size_t *job) {
+    pthread_mutex_lock(&d->lock);
+    bool ok = d->head < d->tail;
+    if (ok) *job = d->jobs[--d->tail];
+    pthread_mutex_unlock(&d->lock);
+    return ok;
+}
+
+static void *pool_thread_main(void *arg) {
+    PoolThread *t = arg;
+    Pool *p = t->pool;
+    size_t job;
+    for (;;) {
+        if (pool_pop(&p->deques[t->id], &job)) {
+            p->fn(p->workers[t->id], job, p->shared);
+            continue;
+        }
+        // Own deque is empty: scan victims once. Jobs are never added after
+        // start, so an empty sweep means the whole pool is drained.
+        bool stole = false;
+        for (int k = 1; k < p->n_workers && !stole; k++) {
+            int victim = (t->id + k) % p->n_workers;
+            stole = pool_steal(&p->deques[victim], &job);
+        }
+        if (!stole) {
+            if (p->idle && p->idle(p->workers[t->id], p->shared)) continue;
+            break;
+        }
+        p->fn(p->workers[t->id], job, p->shared);
+    }
+    return NULL;
+}
+
+static inline int pool_default_workers() {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0) ? (int)n : 1;
+}
+
+// Runs fn(workers[w], job, shared) for every job in [0, n_jobs).
+// With one worker the jobs run on the calling thread, in weight order.
+// `idle` may be NULL.
+static void pool_run(size_t n_jobs, const uint64_t *weights, int n_workers, void **workers,
+                     pool_job_fn fn, pool_idle_fn idle, void *shared) {
+    if (n_jobs == 0) return;
+    if (n_workers < 1) n_workers = 1;
+
+    size_t *order = malloc(n_jobs * sizeof(size_t));
+    for (size_t i = 0; i < n_jobs; i++) order[i] = i;
+    qsort_r(order, n_jobs, sizeof(size_t), pool_weight_cmp, (void *)weights);
+
+    Pool p = { .n_workers = n_workers, .workers = workers, .fn = fn, .idle = idle, .shared = shared };
+    p.deques = calloc(n_workers, sizeof(PoolDeque));
+    for (int w = 0; w < n_workers; w++) {
+        p.deques[w].jobs = malloc((n_jobs / n_workers + 1) * sizeof(size_t));
+        pthread_mutex_init(&p.deques[w].lock, NULL);
+    }
+    for (size_t i = 0; i < n_jobs; i++) {
+        PoolDeque *d = &p.deques[i % n_workers];
+        d->jobs[d->tail++] = order[i];
+    }
+    free(order);
+
+    PoolThread *threads = calloc(n_workers, sizeof(PoolThread));
+    pthread_t *tids = calloc(n_workers, sizeof(pthread_t));
+    for (int w = 0; w < n_workers; w++) {
+        threads[w].pool = &p;
+        threads[w].id = w;
+        if (w > 0) pthread_create(&tids[w], NULL, pool_thread_main, &threads[w]);
+    }
+    pool_thread_main(&threads[0]);
+    for (int w = 1; w < n_workers; w++) pthread_join(tids[w], NULL);
+
+    for (int w = 0; w < n_workers; w++) {
+        pthread_mutex_destroy(&p.deques[w].lock);
+        free(p.deques[w].jobs);
+    }
+    free(p.deques);
+    free(threads);
+    free(tids);
+}
+
+#endif
@@ -0,0 +1,262 @@
+/* * NSET v6.0 - Intra-File Ranges
+ * -------------------------------------------------------
+ * Phase two of one big file (an amalgamation, a generated table) split
+ * across threads. The leaves are cut into ranges of about `range_bytes`
+ * of source, always between two top-level items, each range is
+ * tokenized into an arena of its own, and the arenas are stitched back
+ * in order. Cuts depend on the source only, never on the thread count,
+ * and the stitched tokens are the ones a single pass emits:
+ * - absorption: the lookahead maps cover the whole file and are built
+ *   before the split, so the last token of a range still absorbs the
+ *   symbol that opens the next one
+ * - eaten symbols: a range only starts at a short leaf that is not an
+ *   absorbable symbol and always emits a token (a keyword, a type, a
+ *   name), so nothing in it depends on the token before the seam
+ * - the online model: a counting pass tallies the identifier bigrams of
+ *   every range in parallel, and range r starts from the file's model
+ *   plus the counts of ranges 0..r-1, the model a single pass would
+ *   hold on reaching it
+ * Range jobs run on threads that already exist. The file's own worker
+ * posts each pass (counting, then tokenizing) on the RangeBoard and
+ * takes part in it. Workers of the file pool with no file left pick up
+ * the other jobs instead of exiting (pool_run's idle hook), so a split
+ * never adds a thread: it only uses workers that would otherwise idle.
+ * The buffers belong to a worker and are reused across files.
+ */
+
+#ifndef NSET_RANGES_H
+#define NSET_RANGES_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "dispatch.h"
+#include "entropy.h"
+#include "leaves.h"
+#include "lookahead.h"
+#include "memo.h"
+
+#define RANGE_SEAM_MAX_LEN 32   // Longer leaves may be split as macro blobs
+
+typedef struct {
+    uint32_t first, last;   // Leaves [first, last)
+    Arena *tokens;          // The caller's arena for range 0, `own` for the rest
+    Arena own;
+    EntropyModel *model;    // Counting pass: the range's bigram counts. Then the
+                            // model it starts from and learns into.
+} LeafRange;
+
+typedef struct {
+    LeafRange *ranges;
+    uint32_t count, capacity;
+    EntropyModel *scratch;  // Running prefix + one range's counts
+    bool huge;
+    // Stats
+    uint64_t splits, total_ranges;
+} RangeSplit;
+
+static inline void ranges_init(RangeSplit *rs, bool huge) {
+    memset(rs, 0, sizeof(*rs));
+    rs->huge = huge;
+}
+
+// A range may start at `leaf` if the leaf is never eaten and emits at
+// least one token, so the range's first eaten check sees a token of its own.
+static inline bool range_seam_ok(const LeafSpans *l, const Lookahead *la, uint32_t leaf) {
+    uint32_t start = l->start[leaf], len = l->end[leaf] - start;
+    if (len == 0 || len > RANGE_SEAM_MAX_LEN || lookahead_marked(la, start)) return false;
+    if (l->cls[leaf] == NODE_OTHER) return true;
+    // Only a run of underscores splits into no pieces
+    return l->cls[leaf] == NODE_IDENTIFIER && la->code[start] != '_';
+}
+
+static inline void ranges_add(RangeSplit *rs, uint32_t first, uint32_t last) {
+    if (rs->count == rs->capacity) {
+        uint32_t cap = rs->capacity ? rs->capacity * 2 : 16;
+        rs->ranges = realloc(rs->ranges, cap * sizeof(LeafRange));
+        for (uint32_t r = rs->capacity; r < cap; r++) {
+            arena_init(&rs->ranges[r].own, rs->huge);
+            rs->ranges[r].model = NULL;
+        }
+        rs->capacity = cap;
+    }
+    uint32_t r = rs->count++;
+    rs->ranges[r].first = first;
+    rs->ranges[r].last = last;
+}
+
+// Cuts the leaves (classified, with `la` built) into ranges of at least
+// `range_bytes` of source. Range 0 emits into `out`. Returns the number
+// of ranges; 1 means the file is not worth splitting.
+static inline uint32_t ranges_plan(RangeSplit *rs, const LeafSpans *l, const Lookahead *la, uint64_t range_bytes, Arena *out) {
+    rs->count = 0;
+    uint32_t first = 0;
+    for (uint32_t t = 0; t < l->top_count; t++) {
+        uint32_t leaf = l->top[t];
+        if (leaf <= first || leaf >= l->count) continue;
+        if (l->start[leaf] - l->start[first] < range_bytes || !range_seam_ok(l, la, leaf)) continue;
+        ranges_add(rs, first, leaf);
+        first = leaf;
+    }
+    ranges_add(rs, first, l->count);
+    rs->ranges[0].tokens = out;
+    for (uint32_t r = 1; r < rs->count; r++) rs->ranges[r].tokens = &rs->ranges[r].own;
+    return rs->count;
+}
+
+// Counting pass of range r: the bigrams its identifiers will train.
+// Thread-safe across ranges.
+static inline void ranges_count(RangeSplit *rs, uint32_t r, const LeafSpans *l, const char *code) {
+    LeafRange *range = &rs->ranges[r];
+    if (!range->model) range->model = malloc(sizeof(EntropyModel));
+    memset(range->model, 0, MODEL_COUNTERS * sizeof(uint32_t));
+    for (uint32_t i = range->first; i < range->last; i++) {
+        // Same length the leaf loop trains on
+        uint16_t len = l->end[i] - l->start[i];
+        if (l->cls[i] == NODE_IDENTIFIER) model_count_sequence(range->model, code + l->start[i], len);
+    }
+}
+
+// Replaces each range's counts with the model it starts from: `start`
+// plus the counts of every range before it.
+static inline void ranges_prefix(RangeSplit *rs, const EntropyModel *start) {
+    if (!rs->scratch) rs->scratch = malloc(2 * sizeof(EntropyModel));
+    EntropyModel *acc = &rs->scratch[0], *counts = &rs->scratch[1];
+    memcpy(acc, start, sizeof(EntropyModel));
+    for (uint32_t r = 0; r < rs->count; r++) {
+        EntropyModel *m = rs->ranges[r].model;
+        memcpy(counts, m, MODEL_COUNTERS * sizeof(uint32_t));
+        model_copy(m, acc);
+        if (r + 1 == rs->count) break;
+        model_merge(acc, counts);
+        model_rebuild(acc);
+    }
+}
+
+// Appends the tokens of ranges 1.. to range 0's arena, in order.
+static inline void ranges_stitch(RangeSplit *rs) {
+    Arena *out = rs->ranges[0].tokens;
+    for (uint32_t r = 1; r < rs->count; r++) {
+        Arena *a = rs->ranges[r].tokens;
+        for (size_t i = 0; i < a->count; i++) {
+            NSET_Token t = arena_get(a, i);
+            arena_append(out, &t);
+        }
+        arena_reset(a);
+    }
+    rs->splits++;
+    rs->total_ranges += rs->count;
+}
+
+static inline void ranges_free(RangeSplit *rs) {
+    for (uint32_t r = 0; r < rs->capacity; r++) {
+        arena_free(&rs->ranges[r].own);
+        free(rs->ranges[r].model);
+    }
+    free(rs->ranges); free(rs->scratch);
+    rs->ranges = NULL; rs->scratch = NULL;
+    rs->count = rs->capacity = 0;
+}
+
+// ==========================================
+// RANGE BOARD
+// ==========================================
+// fn(worker, job, shared) for one range; `worker` is whichever file
+// worker runs it (its memo cache is free while it has no file).
+typedef void (*range_job_fn)(void *worker, uint32_t job, void *shared);
+
+typedef struct RangePass {
+    range_job_fn fn;
+    void *shared;
+    uint32_t total;
+    uint32_t next, done;          // Guarded by the board lock
+    struct RangePass *next_open;
+} RangePass;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t work;          // A pass was posted, or the last file finished
+    pthread_cond_t finished;      // Some pass ran its last job
+    RangePass *open;              // Passes with jobs left to claim
+    size_t files_left;            // File jobs not finished yet
+    uint64_t helped;              // Jobs run by a worker other than the poster
+} RangeBoard;
+
+static inline void range_board_init(RangeBoard *b, size_t files) {
+    memset(b, 0, sizeof(*b));
+    pthread_mutex_init(&b->lock, NULL);
+    pthread_cond_init(&b->work, NULL);
+    pthread_cond_init(&b->finished, NULL);
+    b->files_left = files;
+}
+
+// Claims the next job of `pass` (any open pass if NULL). Lock held.
+static inline bool range_board_claim(RangeBoard *b, RangePass **pass, uint32_t *job) {
+    RangePass **link = &b->open;
+    if (*pass) while (*link && *link != *pass) link = &(*link)->next_open;
+    RangePass *p = *link;
+    if (!p) return false;
+    *job = p->next++;
+    if (p->next == p->total) *link = p->next_open;
+    *pass = p;
+    return true;
+}
+
+// Lock held on entry and exit.
+static inline void range_board_execute(RangeBoard *b, RangePass *p, uint32_t job, void *worker) {
+    pthread_mutex_unlock(&b->lock);
+    p->fn(worker, job, p->shared);
+    pthread_mutex_lock(&b->lock);
+    if (++p->done == p->total) pthread_cond_broadcast(&b->finished);
+}
+
+// Runs every job of a pass: posts it for idle workers, works on it too,
+// and returns once all its jobs are done.
+static inline void range_board_run(RangeBoard *b, range_job_fn fn, void *shared, uint32_t total, void *worker) {
+    RangePass pass = { fn, shared, total, 0, 0, NULL };
+    if (total == 0) return;
+    pthread_mutex_lock(&b->lock);
+    pass.next_open = b->open;
+    b->open = &pass;
+    pthread_cond_broadcast(&b->work);
+    RangePass *p = &pass;
+    uint32_t job, mine = 0;
+    while (range_board_claim(b, &p, &job)) {
+        range_board_execute(b, p, job, worker);
+        mine++;
+    }
+    while (pass.done < pass.total) pthread_cond_wait(&b->finished, &b->lock);
+    b->helped += pass.total - mine;
+    pthread_mutex_unlock(&b->lock);
+}
+
+// Idle hook of the file pool: waits for range jobs and runs them.
+// Returns false once no file is left, so no job can be posted any more.
+static inline bool range_board_help(RangeBoard *b, void *worker) {
+    pthread_mutex_lock(&b->lock);
+    while (!b->open && b->files_left > 0) pthread_cond_wait(&b->work, &b->lock);
+    RangePass *p = NULL;
+    uint32_t job;
+    bool claimed = range_board_claim(b, &p, &job);
+    if (claimed) range_board_execute(b, p, job, worker);
+    pthread_mutex_unlock(&b->lock);
+    return claimed;
+}
+
+static inline void range_board_file_done(RangeBoard *b) {
+    pthread_mutex_lock(&b->lock);
+    if (--b->files_left == 0) pthread_cond_broadcast(&b->work);
+    pthread_mutex_unlock(&b->lock);
+}
+
+static inline void range_board_free(RangeBoard *b) {
+    pthread_mutex_destroy(&b->lock);
+    pthread_cond_destroy(&b->work);
+    pthread_cond_destroy(&b->finished);
+}
+
+#endif
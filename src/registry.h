@@ -0,0 +1,528 @@
+/* * NSET v6.0 - Persistent Vocabulary Registry
+ * -------------------------------------------------------
+ * On-disk format (version 2), all integers little-endian:
+ *
+ *   [Header   64 bytes ] magic "NSETVOC\0", offsets, checksums
+ *   [Records  N bytes  ] [id: u32][len: u16][text: len bytes] ...
+ *   [Index    4*S bytes] open-addressing table of ids (0 = empty)
+ *   [Tail     ...      ] records appended since the last compaction
+ *
+ * The indexed part is mmap'd read-only, so has_seen_id() works with
+ * no load phase. Only the tail is scanned at startup; a torn last
+ * record is truncated away. When the tail grows past 1/8 of the
+ * indexed entries, close_registry() rewrites the file with a fresh
+ * index (tmp file + rename). Legacy v1 streams ([id][u8 len][text])
+ * are migrated on first open.
+ *
+ * Processes: several may share the file. Journal commits (journal.h)
+ * hold a shared flock() while they append; compaction and torn-record
+ * truncation hold it exclusively, so neither mistakes a batch in flight
+ * for a torn write or loses it to the rename.
+ *
+ * Concurrency: the snapshot is immutable and the overlay is a lock-free
+ * open-addressing table. Inserting is a compare-and-swap on the empty
+ * slot; only the thread whose CAS wins appends the text to the sink.
+ * Lookups are plain atomic loads and never wait.
+ *
+ * Growth: the overlay starts at 4K slots. When an insert pushes it past
+ * the load factor, a table twice the size is published and the old one
+ * is sealed. Inserters copy a few 1K-slot chunks of the old table each
+ * (incremental rehash); lookups probe both until the copy is complete.
+ */
+
+#ifndef NSET_REGISTRY_H
+#define NSET_REGISTRY_H
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "journal.h"
+
+#define NSET_VOCAB_PATH       "nset_vocab.bin"
+#define NSET_VOCAB_MAGIC      "NSETVOC"
+#define NSET_VOCAB_VERSION    2
+#define NSET_VOCAB_REC_HEADER 6       // id (4) + len (2)
+#define NSET_VOCAB_MIN_SLOTS  1024
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t entry_count;     // Entries covered by the index
+    uint64_t records_offset;
+    uint64_t records_bytes;
+    uint64_t index_offset;    // 8-byte aligned
+    uint64_t index_slots;     // Power of two
+    uint32_t body_checksum;   // FNV-1a over records + index
+    uint32_t header_checksum; // FNV-1a over all preceding header bytes
+} NSET_VocabHeader;
+
+_Static_assert(sizeof(NSET_VocabHeader) == 64, "vocab header must stay 64 bytes");
+
+// ==========================================
+// STATE
+// ==========================================
+#define NSET_OVERLAY_MIN_SLOTS 4096
+#define NSET_OVERLAY_CHUNK     1024   // Slots copied per migration step
+#define NSET_DEFAULT_LOAD      0.5
+
+typedef struct OverlayTable {
+    _Atomic uint32_t *slots;
+    uint64_t mask;
+    uint64_t grow_at;                     // Occupancy that triggers the next resize
+    _Atomic uint64_t used;
+    _Atomic int active;                   // Inserts in flight
+    _Atomic bool sealed;                  // A successor exists; no new inserts here
+    _Atomic bool ready;                   // Predecessor drained; inserts may start
+    _Atomic bool growing;                 // Claimed by the thread building the successor
+    struct OverlayTable *_Atomic prev;    // Being migrated into this table
+    _Atomic uint64_t migrate_next;
+    _Atomic uint64_t migrate_done;
+    struct OverlayTable *retired;         // Older tables; readers may still hold them
+} OverlayTable;
+
+typedef struct {
+    const char *path;
+    // Snapshot: read-only view of the indexed part of the file
+    uint8_t *map;
+    size_t map_size;
+    const uint32_t *index;
+    uint64_t index_mask;
+    uint64_t entry_count;
+    // Overlay: ids from the tail and from this run
+    OverlayTable *_Atomic overlay;
+    double max_load;
+    _Atomic uint32_t resizes;
+    _Atomic uint64_t tail_count;
+    VocabJournal journal;        // Sink for new records; only CAS winners append
+    bool journal_open;
+} NSET_Registry;
+
+static NSET_Registry registry = { .max_load = NSET_DEFAULT_LOAD };
+
+static inline uint32_t registry_checksum(const void *data, size_t len, uint32_t h) {
+    const uint8_t *p = data;
+    for (size_t i = 0; i < len; i++) { h ^= p[i]; h *= 0x01000193; }
+    return h;
+}
+
+static inline uint32_t registry_header_checksum(const NSET_VocabHeader *h) {
+    return registry_checksum(h, offsetof(NSET_VocabHeader, header_checksum), 0x811c9dc5);
+}
+
+// ==========================================
+// LOOKUP
+// ==========================================
+static inline bool snapshot_has_id(uint32_t id) {
+    if (!registry.index) return false;
+    uint64_t idx = id & registry.index_mask;
+    while (registry.index[idx] != 0) {
+        if (registry.index[idx] == id) return true;
+        idx = (idx + 1) & registry.index_mask;
+    }
+    return false;
+}
+
+static OverlayTable *overlay_table_new(uint64_t slots, OverlayTable *prev) {
+    OverlayTable *t = calloc(1, sizeof(OverlayTable));
+    t->slots = calloc(slots, sizeof(_Atomic uint32_t));
+    t->mask = slots - 1;
+    t->grow_at = (uint64_t)(slots * registry.max_load);
+    atomic_init(&t->prev, prev);
+    atomic_init(&t->ready, prev == NULL);
+    t->retired = prev;
+    return t;
+}
+
+static inline bool table_has_id(OverlayTable *t, uint32_t id) {
+    uint64_t idx = id & t->mask;
+    uint32_t slot;
+    while ((slot = atomic_load_explicit(&t->slots[idx], memory_order_relaxed)) != 0) {
+        if (slot == id) return true;
+        idx = (idx + 1) & t->mask;
+    }
+    return false;
+}
+
+// CAS-claims a slot in `t`. Returns false if `id` is already there, including
+// when a concurrent inserter of the same id wins the race. Inserts stop at
+// the load factor (at most 0.9), so an empty slot is always reachable.
+static inline bool table_insert(OverlayTable *t, uint32_t id) {
+    uint64_t idx = id & t->mask;
+    for (;;) {
+        uint32_t slot = atomic_load_explicit(&t->slots[idx], memory_order_relaxed);
+        if (slot == id) return false;
+        if (slot == 0) {
+            uint32_t expected = 0;
+            if (atomic_compare_exchange_strong(&t->slots[idx], &expected, id)) return true;
+            if (expected == id) return false;
+        }
+        idx = (idx + 1) & t->mask;
+    }
+}
+
+static inline bool overlay_has_id(uint32_t id) {
+    OverlayTable *t = atomic_load(&registry.overlay);
+    if (table_has_id(t, id)) return true;
+    OverlayTable *p = atomic_load(&t->prev);
+    return p && table_has_id(p, id);
+}
+
+// Copies up to `budget` chunks of the sealed predecessor into `t`.
+// Returns false once every chunk has been claimed by some thread.
+static bool overlay_migrate(OverlayTable *t, OverlayTable *p, uint64_t budget) {
+    uint64_t cap = p->mask + 1;
+    while (budget-- > 0) {
+        uint64_t start = atomic_fetch_add(&t->migrate_next, NSET_OVERLAY_CHUNK);
+        if (start >= cap) return false;
+        for (uint64_t i = start; i < start + NSET_OVERLAY_CHUNK; i++) {
+            uint32_t id = atomic_load_explicit(&p->slots[i], memory_order_relaxed);
+            if (id != 0 && table_insert(t, id)) atomic_fetch_add(&t->used, 1);
+        }
+        if (atomic_fetch_add(&t->migrate_done, NSET_OVERLAY_CHUNK) + NSET_OVERLAY_CHUNK == cap)
+            atomic_store(&t->prev, NULL); // Lookups stop probing it; memory lives until close
+    }
+    return true;
+}
+
+static void overlay_grow(OverlayTable *t) {
+    bool expected = false;
+    if (!atomic_compare_exchange_strong(&t->growing, &expected, true)) return;
+
+    // Keep the chain two tables deep: finish the previous migration first.
+    OverlayTable *p;
+    while ((p = atomic_load(&t->prev)) != NULL)
+        if (!overlay_migrate(t, p, UINT64_MAX)) sched_yield(); // Last chunks still in flight
+
+    OverlayTable *next = overlay_table_new((t->mask + 1) * 2, t);
+    atomic_store(&registry.overlay, next);
+    atomic_store(&t->sealed, true);
+    // Wait out inserts that passed the seal check before it was set. Each is
+    // a single CAS, so this is a few hundred nanoseconds, not a rehash.
+    while (atomic_load(&t->active) != 0) sched_yield();
+    atomic_store(&next->ready, true);
+    atomic_fetch_add(&registry.resizes, 1);
+}
+
+// Returns true only for the one caller that actually inserted `id`.
+static bool overlay_insert(uint32_t id) {
+    for (;;) {
+        OverlayTable *t = atomic_load(&registry.overlay);
+        if (!atomic_load(&t->ready)) { sched_yield(); continue; }
+        OverlayTable *p = atomic_load(&t->prev);
+        if (p) overlay_migrate(t, p, 2);
+        // Past the load factor nothing more goes in; wait for the successor.
+        if (atomic_load(&t->used) >= t->grow_at) { overlay_grow(t); sched_yield(); continue; }
+
+        atomic_fetch_add(&t->active, 1);
+        if (atomic_load(&t->sealed)) { atomic_fetch_sub(&t->active, 1); continue; }
+        // The predecessor is immutable once `ready` is set, so one probe of it
+        // settles whether the id predates this table.
+        bool won = !(p && table_has_id(p, id)) && table_insert(t, id);
+        atomic_fetch_sub(&t->active, 1);
+
+        if (won && atomic_fetch_add(&t->used, 1) + 1 >= t->grow_at) overlay_grow(t);
+        return won;
+    }
+}
+
+static inline bool has_seen_id(uint32_t id) {
+    return snapshot_has_id(id) || overlay_has_id(id);
+}
+
+// ==========================================
+// RECORD SCANNING
+// ==========================================
+// Walks records in [pos, end). Returns the offset just past the last
+// complete record; anything after it is a torn write.
+typedef void (*registry_record_fn)(uint32_t id, const uint8_t *text, uint16_t len, void *ctx);
+
+static size_t registry_scan(const uint8_t *base, size_t pos, size_t end, bool legacy,
+                            registry_record_fn fn, void *ctx) {
+    size_t hdr = legacy ? 5 : NSET_VOCAB_REC_HEADER;
+    while (pos + hdr <= end) {
+        uint32_t id; uint16_t len;
+        memcpy(&id, base + pos, 4);
+        if (legacy) len = base[pos + 4];
+        else memcpy(&len, base + pos + 4, 2);
+        // A zero id never gets registered; seeing one means a zero-filled torn block.
+        if (id == 0 || pos + hdr + len > end) break;
+        if (fn) fn(id, base + pos + hdr, len, ctx);
+        pos += hdr + len;
+    }
+    return pos;
+}
+
+static void count_record(uint32_t id, const uint8_t *text, uint16_t len, void *ctx) {
+    (void)id; (void)text; (void)len;
+    (*(uint64_t *)ctx)++;
+}
+
+static void tail_record(uint32_t id, const uint8_t *text, uint16_t len, void *ctx) {
+    (void)text; (void)len; (void)ctx;
+    if (!snapshot_has_id(id) && overlay_insert(id)) registry.tail_count++;
+}
+
+// ==========================================
+// COMPACTION
+// ==========================================
+typedef struct {
+    FILE *out;
+    uint32_t *index;
+    uint64_t mask;
+    uint64_t count;
+    uint64_t bytes;
+    uint32_t checksum;
+} RegistryWriter;
+
+static void compact_record(uint32_t id, const uint8_t *text, uint16_t len, void *ctx) {
+    RegistryWriter *w = ctx;
+    uint64_t idx = id & w->mask;
+    while (w->index[idx] != 0) {
+        if (w->index[idx] == id) return; // Duplicate (e.g. two processes appended it)
+        idx = (idx + 1) & w->mask;
+    }
+    w->index[idx] = id;
+
+    uint8_t rec[NSET_VOCAB_REC_HEADER];
+    memcpy(rec, &id, 4); memcpy(rec + 4, &len, 2);
+    fwrite(rec, 1, sizeof(rec), w->out);
+    fwrite(text, 1, len, w->out);
+    w->checksum = registry_checksum(rec, sizeof(rec), w->checksum);
+    w->checksum = registry_checksum(text, len, w->checksum);
+    w->bytes += sizeof(rec) + len;
+    w->count++;
+}
+
+// Rewrites `path` as a fresh v2 file from the records in `base`.
+// `expected` must count every record scanned (duplicates included): the
+// index gets at least twice as many slots, so its probes always end.
+static bool registry_rewrite(const char *path, const uint8_t *base, size_t size,
+                             size_t rec_start, size_t rec_end, size_t tail_start, bool legacy,
+                             uint64_t expected) {
+    char tmp_path[4096];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *out = fopen(tmp_path, "wb");
+    if (!out) return false;
+
+    uint64_t slots = NSET_VOCAB_MIN_SLOTS;
+    while (slots < expected * 2) slots <<= 1;
+
+    RegistryWriter w = { .out = out, .mask = slots - 1, .checksum = 0x811c9dc5 };
+    w.index = calloc(slots, sizeof(uint32_t));
+    if (!w.index) { fclose(out); remove(tmp_path); return false; }
+
+    NSET_VocabHeader h = {0};
+    fwrite(&h, sizeof(h), 1, out);
+    registry_scan(base, rec_start, rec_end, legacy, compact_record, &w);
+    if (tail_start < size) registry_scan(base, tail_start, size, false, compact_record, &w);
+
+    static const uint8_t pad[8] = {0};
+    size_t padding = (8 - (sizeof(h) + w.bytes) % 8) % 8;
+    fwrite(pad, 1, padding, out);
+    fwrite(w.index, sizeof(uint32_t), slots, out);
+    w.checksum = registry_checksum(w.index, slots * sizeof(uint32_t), w.checksum);
+
+    memcpy(h.magic, NSET_VOCAB_MAGIC, sizeof(NSET_VOCAB_MAGIC));
+    h.version = NSET_VOCAB_VERSION;
+    h.header_size = sizeof(h);
+    h.entry_count = w.count;
+    h.records_offset = sizeof(h);
+    h.records_bytes = w.bytes;
+    h.index_offset = sizeof(h) + w.bytes + padding;
+    h.index_slots = slots;
+    h.body_checksum = w.checksum;
+    h.header_checksum = registry_header_checksum(&h);
+    fseek(out, 0, SEEK_SET);
+    fwrite(&h, sizeof(h), 1, out);
+    free(w.index);
+
+    bool ok = (fflush(out) == 0) && (fsync(fileno(out)) == 0);
+    ok = (fclose(out) == 0) && ok;
+    if (!ok || rename(tmp_path, path) != 0) { remove(tmp_path); return false; }
+    return true;
+}
+
+// Validates the header of a mapped file. Returns false for legacy/corrupt data.
+static bool registry_header_ok(const uint8_t *base, size_t size, const NSET_VocabHeader **out) {
+    if (size < sizeof(NSET_VocabHeader)) return false;
+    const NSET_VocabHeader *h = (const NSET_VocabHeader *)base;
+    if (memcmp(h->magic, NSET_VOCAB_MAGIC, sizeof(NSET_VOCAB_MAGIC)) != 0) return false;
+    if (h->version != NSET_VOCAB_VERSION || h->header_size != sizeof(*h)) return false;
+    if (h->header_checksum != registry_header_checksum(h)) return false;
+    if (h->index_slots == 0 || (h->index_slots & (h->index_slots - 1)) != 0) return false;
+    if (h->index_offset % 8 != 0 || h->index_offset + h->index_slots * 4 > size) return false;
+    if (h->records_offset + h->records_bytes > h->index_offset) return false;
+    *out = h;
+    return true;
+}
+
+// Full body verification (used before compaction and by tools/inspector.py).
+static bool registry_body_ok(const uint8_t *base, const NSET_VocabHeader *h) {
+    uint32_t c = registry_checksum(base + h->records_offset, h->records_bytes, 0x811c9dc5);
+    c = registry_checksum(base + h->index_offset, h->index_slots * 4, c);
+    return c == h->body_checksum;
+}
+
+static inline bool has_magic(const uint8_t *base, size_t size) {
+    return size >= 8 && memcmp(base, NSET_VOCAB_MAGIC, sizeof(NSET_VOCAB_MAGIC)) == 0;
+}
+
+// ==========================================
+// LIFECYCLE
+// ==========================================
+// load_factor <= 0 keeps the default; values are clamped to [0.1, 0.9].
+static void init_registry(double load_factor) {
+    if (load_factor > 0) registry.max_load = load_factor < 0.1 ? 0.1 : (load_factor > 0.9 ? 0.9 : load_factor);
+    registry.overlay = overlay_table_new(NSET_OVERLAY_MIN_SLOTS, NULL);
+}
+
+static void load_registry(const char *path) {
+    registry.path = path;
+    int fd = open(path, O_RDWR);
+    if (fd < 0) return;
+
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || sb.st_size == 0) { close(fd); return; }
+    size_t size = sb.st_size;
+    uint8_t *base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) { close(fd); return; }
+
+    const NSET_VocabHeader *h = NULL;
+    if (!registry_header_ok(base, size, &h)) {
+        bool migrated = false;
+        if (!has_magic(base, size)) {
+            printf(">> Migrating legacy (v1) vocabulary...\n");
+            uint64_t count = 0;
+            size_t end = registry_scan(base, 0, size, true, count_record, &count);
+            migrated = registry_rewrite(path, base, size, 0, end, size, true, count);
+        } else {
+            // Offsets in a corrupt header cannot be trusted; start over beside it.
+            char aside[4096];
+            snprintf(aside, sizeof(aside), "%s.corrupt", path);
+            printf(">> Vocabulary header corrupt, moved to %s\n", aside);
+            rename(path, aside);
+        }
+        munmap(base, size);
+        close(fd);
+        if (migrated) load_registry(path);
+        return;
+    }
+
+    registry.map = base;
+    registry.map_size = size;
+    registry.index = (const uint32_t *)(base + h->index_offset);
+    registry.index_mask = h->index_slots - 1;
+    registry.entry_count = h->entry_count;
+
+    size_t tail_start = h->index_offset + h->index_slots * 4;
+    size_t tail_end = registry_scan(base, tail_start, size, false, tail_record, NULL);
+    // Writers append under a shared lock: with it held exclusively, a file
+    // that has not grown really ends in a torn record. One that grew was
+    // mid-commit; its records are complete now and stay.
+    if (tail_end < size && flock(fd, LOCK_EX) == 0 && fstat(fd, &sb) == 0 && (size_t)sb.st_size == size) {
+        printf(">> Dropping torn vocabulary record (%lu bytes).\n", (unsigned long)(size - tail_end));
+        if (ftruncate(fd, tail_end) != 0) perror("ftruncate");
+    }
+    close(fd);
+
+    printf(">> Vocabulary mapped: %lu indexed + %lu tail entries.\n",
+           (unsigned long)registry.entry_count, (unsigned long)registry.tail_count);
+}
+
+static bool open_vocab_sink(JournalFsync policy) {
+    struct stat sb;
+    if (!registry.map && (stat(registry.path, &sb) != 0 || sb.st_size == 0)) {
+        // Fresh registry: lay down an empty indexed file so appends form a valid tail.
+        static const uint8_t empty = 0;
+        if (!registry_rewrite(registry.path, &empty, 0, 0, 0, 0, false, 0)) return false;
+    }
+    registry.journal_open = journal_open(&registry.journal, registry.path, policy);
+    return registry.journal_open;
+}
+
+static void register_token(uint32_t id, const char *text, int len) {
+    if (snapshot_has_id(id) || overlay_has_id(id)) return;
+    if (!overlay_insert(id)) return; // Another thread won the race
+    atomic_fetch_add_explicit(&registry.tail_count, 1, memory_order_relaxed);
+
+    if (registry.journal_open) {
+        uint16_t l = (len > UINT16_MAX) ? UINT16_MAX : (uint16_t)len;
+        uint8_t rec[NSET_VOCAB_REC_HEADER];
+        memcpy(rec, &id, 4); memcpy(rec + 4, &l, 2);
+        journal_append(&registry.journal, rec, sizeof(rec), text, l);
+    }
+}
+
+// Opens `path` locked exclusively. If another process compacted it while
+// this one waited, the lock is on a replaced file: retry on the new one.
+static int registry_lock_current(const char *path, struct stat *sb) {
+    for (;;) {
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) return -1;
+        struct stat now;
+        if (flock(fd, LOCK_EX) != 0 || fstat(fd, sb) != 0 || stat(path, &now) != 0) {
+            close(fd);
+            return -1;
+        }
+        if (sb->st_dev == now.st_dev && sb->st_ino == now.st_ino) return fd;
+        close(fd);
+    }
+}
+
+// Flushes the tail and compacts it into the index once it is large enough.
+static void close_registry() {
+    if (registry.journal_open) { journal_close(&registry.journal); registry.journal_open = false; }
+
+    if (registry.tail_count > 0 && registry.tail_count * 8 >= registry.entry_count) {
+        struct stat sb;
+        int fd = registry_lock_current(registry.path, &sb);
+        if (fd >= 0) {
+            size_t size = sb.st_size;
+            uint8_t *base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+            const NSET_VocabHeader *h = NULL;
+            if (base != MAP_FAILED && registry_header_ok(base, size, &h) && registry_body_ok(base, h)) {
+                size_t tail_start = h->index_offset + h->index_slots * 4;
+                // Size the index from the file as it is now: other processes
+                // may have appended to the tail since this one loaded it.
+                uint64_t tail = 0;
+                registry_scan(base, tail_start, size, false, count_record, &tail);
+                if (registry_rewrite(registry.path, base, size, h->records_offset,
+                                     h->records_offset + h->records_bytes, tail_start, false,
+                                     h->entry_count + tail))
+                    printf(">> Vocabulary compacted (%lu new entries indexed).\n", (unsigned long)tail);
+            }
+            if (base != MAP_FAILED) munmap(base, size);
+        }
+        if (fd >= 0) close(fd);
+    }
+
+    if (registry.map) munmap(registry.map, registry.map_size);
+    OverlayTable *t = registry.overlay;
+    if (registry.resizes > 0)
+        printf(">> Registry overlay: %lu ids in %lu slots (load %.2f, %u resizes).\n",
+               (unsigned long)t->used, (unsigned long)(t->mask + 1),
+               (double)t->used / (t->mask + 1), (unsigned)registry.resizes);
+    while (t) {
+        OverlayTable *older = t->retired;
+        free((void *)t->slots);
+        free(t);
+        t = older;
+    }
+    registry.map = NULL; registry.index = NULL; registry.overlay = NULL;
+    registry.entry_count = registry.tail_count = 0;
+}
+
+#endif
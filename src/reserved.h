@@ -0,0 +1,81 @@
+/* * NSET v6.0 - Reserved Token Ids
+ * -------------------------------------------------------
+ * The hottest tokens (keywords, primitive types, directives and
+ * operators) get fixed ids in [1, NSET_RESERVED_IDS) instead of a
+ * hash. They are emitted with no hashing and no registry probe, and
+ * downstream they form one small, dense embedding range.
+ * - The id of a token is its index in RESERVED_TOKENS. The list is
+ *   append-only: never reorder or remove an entry.
+ * - Hashed ids are moved out of the range (see murmur_hash), so the
+ *   two never collide. Reserved ids are not written to the registry;
+ *   this table is their vocabulary.
+ */
+
+#ifndef NSET_RESERVED_H
+#define NSET_RESERVED_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define NSET_RESERVED_IDS 256
+
+static const char *const RESERVED_TOKENS[] = {
+    NULL,   // 0 is never a token id
+    // Keywords
+    "auto", "break", "case", "char", "const", "continue", "default", "do",
+    "double", "else", "enum", "extern", "float", "for", "goto", "if",
+    "inline", "int", "long", "register", "restrict", "return", "short", "signed",
+    "sizeof", "static", "struct", "switch", "typedef", "union", "unsigned", "void",
+    "volatile", "while", "_Alignas", "_Alignof", "_Atomic", "_Bool", "_Complex", "_Generic",
+    "_Imaginary", "_Noreturn", "_Static_assert", "_Thread_local", "__attribute__", "asm", "__asm__", "typeof",
+    "__typeof__", "alignas", "alignof", "bool", "true", "false", "NULL", "nullptr",
+    "thread_local", "static_assert", "constexpr", "__restrict", "__inline", "__extension__",
+    // Primitive types
+    "size_t", "ssize_t", "ptrdiff_t", "intptr_t", "uintptr_t", "charptr_t",
+    "int8_t", "int16_t", "int32_t", "int64_t", "uint8_t", "uint16_t", "uint32_t", "uint64_t",
+    // Preprocessor
+    "#include", "#define", "#if", "#ifdef", "#ifndef", "#else", "#elif", "#elifdef",
+    "#elifndef", "#endif", "#undef", "#pragma", "#error", "#warning", "#line", "defined",
+    // Operators and punctuation
+    "{", "}", "(", ")", "[", "]", ";", ",", ".", "->", "...",
+    "++", "--", "&", "*", "+", "-", "~", "!", "/", "%", "<<", ">>",
+    "<", ">", "<=", ">=", "==", "!=", "^", "|", "&&", "||", "?", ":",
+    "=", "*=", "/=", "%=", "+=", "-=", "<<=", ">>=", "&=", "^=", "|=",
+    "#", "##", "::",
+};
+
+#define NSET_RESERVED_COUNT (sizeof(RESERVED_TOKENS) / sizeof(RESERVED_TOKENS[0]))
+_Static_assert(NSET_RESERVED_COUNT <= NSET_RESERVED_IDS, "reserved tokens overflow their id range");
+
+// Text -> id index, built once by reserved_init() before any lookup.
+#define RESERVED_INDEX_SLOTS 512
+static uint16_t reserved_index[RESERVED_INDEX_SLOTS];
+
+static inline uint32_t reserved_hash(const char *s, int len) {
+    uint32_t h = 0x811c9dc5;
+    for (int i = 0; i < len; i++) { h ^= (uint8_t)s[i]; h *= 0x01000193; }
+    return h;
+}
+
+static inline void reserved_init() {
+    memset(reserved_index, 0, sizeof(reserved_index));
+    for (uint16_t id = 1; id < NSET_RESERVED_COUNT; id++) {
+        uint32_t slot = reserved_hash(RESERVED_TOKENS[id], strlen(RESERVED_TOKENS[id])) & (RESERVED_INDEX_SLOTS - 1);
+        while (reserved_index[slot]) slot = (slot + 1) & (RESERVED_INDEX_SLOTS - 1);
+        reserved_index[slot] = id;
+    }
+}
+
+// Case-sensitive exact match. Returns 0 if `s` is not a reserved token.
+static inline uint16_t reserved_lookup(const char *s, int len) {
+    uint32_t slot = reserved_hash(s, len) & (RESERVED_INDEX_SLOTS - 1);
+    uint16_t id;
+    while ((id = reserved_index[slot]) != 0) {
+        const char *key = RESERVED_TOKENS[id];
+        if ((int)strlen(key) == len && memcmp(key, s, len) == 0) return id;
+        slot = (slot + 1) & (RESERVED_INDEX_SLOTS - 1);
+    }
+    return 0;
+}
+
+#endif
@@ -0,0 +1,273 @@
+/* * NSET v6.0 - Streaming Input Ring
+ * -------------------------------------------------------
+ * Tokenizes input that cannot be mapped (stdin, pipes) in bounded
+ * memory. The input is read into a ring buffer whose pages are mapped
+ * twice, back to back, so any window of up to `cap` bytes is one
+ * contiguous pointer, even across the wrap.
+ *
+ * The stream is cut into segments, and each one is parsed and
+ * tokenized on its own:
+ * - tree-sitter pulls a segment through a TSInput read callback, which
+ *   reads the fd on demand and only ever exposes data up to a cut point
+ * - a boundary scanner runs over every byte as it arrives, keeping its
+ *   state (comments, strings, directives, nesting) across reads, and
+ *   marks the newlines that end a top-level item: brace and paren depth
+ *   0, no open #if, last significant byte ';' or '}' (or a directive),
+ *   next line starting with [A-Za-z_#]
+ * - a segment ends at the first boundary past `target` bytes (half the
+ *   ring); the next one starts at that newline
+ * Leaves therefore never straddle segments, and the byte after a
+ * segment is never an absorbable symbol, so splitting and absorption
+ * see exactly what they would in the whole file. An item bigger than
+ * the ring (or a stream with no boundaries) is cut where the ring is
+ * full; that cut counts as forced.
+ * Offsets are positions in the stream (modulo 2^32, like NSET_Token).
+ */
+
+#ifndef NSET_RING_H
+#define NSET_RING_H
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <tree_sitter/api.h>
+#include <unistd.h>
+
+#define RING_READ (64u << 10)   // Bytes per read() call
+
+// ==========================================
+// BOUNDARY SCANNER
+// ==========================================
+enum { SCAN_CODE, SCAN_LINE_COMMENT, SCAN_BLOCK_COMMENT, SCAN_STRING, SCAN_CHAR, SCAN_DIRECTIVE };
+
+typedef struct {
+    uint8_t mode;         // SCAN_*
+    uint8_t comment_from; // Mode the comment interrupted
+    uint8_t last;         // Last significant code byte (';' after a directive)
+    bool escape;          // Backslash pending
+    bool slash;           // '/' pending: may open a comment
+    bool star;            // '*' seen inside a block comment
+    bool line_start;      // Nothing but spaces since the newline
+    bool after_newline;   // Previous byte ended a line in code
+    int32_t braces, parens;
+    int32_t conds;        // Open #if / #ifdef / #ifndef
+    char name[8];         // Directive name so far
+    uint8_t name_len;     // 0xFF once the name is complete
+} BoundaryScan;
+
+static inline bool scan_ident_start(uint8_t c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static inline void scan_directive_name(BoundaryScan *s) {
+    s->name[s->name_len] = '\0';
+    if (strcmp(s->name, "if") == 0 || strcmp(s->name, "ifdef") == 0 || strcmp(s->name, "ifndef") == 0) s->conds++;
+    else if (strcmp(s->name, "endif") == 0 && s->conds > 0) s->conds--;
+    s->name_len = 0xFF;
+}
+
+// Feeds the next byte. Returns true if the byte before it is a boundary
+// newline.
+static inline bool scan_byte(BoundaryScan *s, uint8_t c) {
+    bool boundary = false;
+    if (s->after_newline) {
+        s->after_newline = false;
+        boundary = (scan_ident_start(c) || c == '#') && s->braces == 0 && s->parens == 0 &&
+                   s->conds == 0 && (s->last == ';' || s->last == '}' || s->last == 0);
+    }
+    if (s->slash) {
+        s->slash = false;
+        if (c == '/') { s->comment_from = s->mode; s->mode = SCAN_LINE_COMMENT; return boundary; }
+        if (c == '*') { s->comment_from = s->mode; s->mode = SCAN_BLOCK_COMMENT; s->star = false; return boundary; }
+        if (s->mode == SCAN_CODE) s->last = '/';
+    }
+    switch (s->mode) {
+    case SCAN_LINE_COMMENT:
+        if (c == '\n') {
+            if (s->comment_from == SCAN_DIRECTIVE) s->last = ';';
+            s->mode = SCAN_CODE;
+            s->line_start = s->after_newline = true;
+        }
+        break;
+    case SCAN_BLOCK_COMMENT:
+        if (s->star && c == '/') s->mode = s->comment_from;
+        s->star = (c == '*');
+        break;
+    case SCAN_STRING:
+    case SCAN_CHAR:
+        if (s->escape) s->escape = false;
+        else if (c == '\\') s->escape = true;
+        else if (c == (s->mode == SCAN_STRING ? '"' : '\'') || c == '\n') {
+            s->mode = SCAN_CODE;
+            s->last = c;
+        }
+        break;
+    case SCAN_DIRECTIVE:
+        if (s->name_len != 0xFF) {
+            if (scan_ident_start(c) && s->name_len < sizeof(s->name) - 1) { s->name[s->name_len++] = c; break; }
+            if (s->name_len > 0 || (c != ' ' && c != '\t')) scan_directive_name(s);
+        }
+        if (s->escape) { s->escape = false; break; }
+        if (c == '\\') s->escape = true;
+        else if (c == '/') s->slash = true;
+        else if (c == '\n') {
+            // A directive ends a top-level item like ';' does
+            s->mode = SCAN_CODE;
+            s->last = ';';
+            s->line_start = s->after_newline = true;
+        }
+        break;
+    default:
+        if (c == '\n') { s->line_start = s->after_newline = true; break; }
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v') break;
+        if (c == '#' && s->line_start) {
+            s->mode = SCAN_DIRECTIVE;
+            s->name_len = 0;
+            s->escape = false;
+        } else if (c == '/') {
+            s->slash = true;
+        } else {
+            if (c == '"') { s->mode = SCAN_STRING; s->escape = false; }
+            else if (c == '\'') { s->mode = SCAN_CHAR; s->escape = false; }
+            else if (c == '{') s->braces++;
+            else if (c == '}') s->braces--;
+            else if (c == '(') s->parens++;
+            else if (c == ')') s->parens--;
+            s->last = c;
+        }
+        s->line_start = false;
+        break;
+    }
+    return boundary;
+}
+
+// ==========================================
+// RING
+// ==========================================
+typedef struct {
+    uint8_t *base;        // 2 * cap bytes: the same pages mapped twice
+    size_t cap;
+    size_t target;        // Segment size to cut at (first boundary past it)
+    int fd;
+    uint64_t head;        // Start of the current segment
+    uint64_t tail;        // End of the data read so far
+    uint64_t limit;       // End of the data exposed to the parser
+    uint64_t boundary;    // Latest boundary newline (0 if none yet)
+    bool limit_boundary;  // `limit` sits on a boundary
+    bool cut;             // The segment ends at `limit`
+    bool eof;
+    int error;            // errno of a failed read, 0 if none
+    BoundaryScan scan;
+    // Stats
+    uint64_t segments;
+    uint64_t forced;      // Segments cut without a boundary
+} InputRing;
+
+static inline const char *ring_at(const InputRing *r, uint64_t pos) {
+    return (const char *)r->base + pos % r->cap;
+}
+
+// Maps a ring of at least `cap` bytes reading from `fd`. False on error, with errno set.
+static inline bool ring_init(InputRing *r, int fd, size_t cap) {
+    memset(r, 0, sizeof(*r));
+    size_t page = sysconf(_SC_PAGESIZE);
+    cap = (cap + page - 1) / page * page;
+    int mfd = memfd_create("nset-ring", 0);
+    if (mfd < 0) return false;
+    uint8_t *base = MAP_FAILED;
+    if (ftruncate(mfd, cap) == 0) base = mmap(NULL, 2 * cap, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    bool ok = base != MAP_FAILED &&
+              mmap(base, cap, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, mfd, 0) != MAP_FAILED &&
+              mmap(base + cap, cap, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, mfd, 0) != MAP_FAILED;
+    int err = errno;
+    close(mfd);
+    if (!ok) {
+        if (base != MAP_FAILED) munmap(base, 2 * cap);
+        errno = err;
+        return false;
+    }
+    r->base = base;
+    r->cap = cap;
+    r->target = cap / 2;
+    r->fd = fd;
+    return true;
+}
+
+// Reads once into the free part of the ring. False when full, at EOF or on error.
+static inline bool ring_fill(InputRing *r) {
+    size_t room = r->cap - (r->tail - r->head);
+    if (room == 0 || r->eof) return false;
+    if (room > RING_READ) room = RING_READ;
+    uint8_t *p = (uint8_t *)ring_at(r, r->tail);
+    ssize_t n = read(r->fd, p, room);
+    if (n < 0 && errno == EINTR) return true;
+    if (n <= 0) {
+        if (n < 0) r->error = errno;
+        r->eof = true;
+        return false;
+    }
+    for (ssize_t i = 0; i < n; i++)
+        if (scan_byte(&r->scan, p[i]) && r->tail + i - 1 > r->head) r->boundary = r->tail + i - 1;
+    r->tail += n;
+    return true;
+}
+
+// The parser wants data past `limit`: expose more or end the segment.
+static inline void ring_advance(InputRing *r) {
+    if (r->limit_boundary && r->limit - r->head >= r->target) { r->cut = true; return; }
+    while (r->boundary <= r->limit && ring_fill(r)) {}
+    if (r->boundary > r->limit) {
+        r->limit = r->boundary;
+        r->limit_boundary = true;
+    } else if (r->tail > r->limit) {
+        // EOF, or the ring is full with no boundary in it
+        r->limit = r->tail;
+        r->limit_boundary = false;
+    } else {
+        r->cut = true;
+    }
+}
+
+static const char *ring_read(void *payload, uint32_t byte_index, TSPoint position, uint32_t *bytes_read) {
+    (void)position;
+    InputRing *r = payload;
+    uint64_t pos = r->head + byte_index;
+    if (pos >= r->limit && !r->cut) ring_advance(r);
+    if (pos >= r->limit) { *bytes_read = 0; return ""; }
+    *bytes_read = r->limit - pos;
+    return ring_at(r, pos);
+}
+
+static inline TSInput ring_input(InputRing *r) {
+    TSInput input = { r, ring_read, TSInputEncodingUTF8 };
+    return input;
+}
+
+// Starts the next segment. False once the input is exhausted.
+static inline bool ring_next(InputRing *r) {
+    if (r->segments > 0) {
+        if (!r->limit_boundary && !r->eof) r->forced++;
+        r->head = r->limit;
+    }
+    r->cut = false;
+    r->limit_boundary = false;
+    if (r->head == r->tail) ring_fill(r);
+    if (r->head == r->tail) return false;
+    r->segments++;
+    return true;
+}
+
+// The current segment, once parsed: [head, limit), contiguous.
+static inline const char *ring_segment(const InputRing *r, size_t *size) {
+    *size = r->limit - r->head;
+    return ring_at(r, r->head);
+}
+
+static inline void ring_free(InputRing *r) {
+    if (r->base) munmap(r->base, 2 * r->cap);
+    r->base = NULL;
+}
+
+#endif
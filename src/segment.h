@@ -0,0 +1,223 @@
+/* * NSET v6.0 - Identifier Segmentation Kernel
+ * -------------------------------------------------------
+ * Classifies a whole identifier in one vectorized pass and hands the
+ * splitter bitmasks instead of bytes:
+ * - under : '_' (hard split)
+ * - upper : [A-Z] (camel boundaries and casing)
+ * - lower : [a-z]
+ * Bit i of word i/64 describes byte i. AVX2 does 32 bytes per step,
+ * SSE2 16, and the scalar fallback uses the charclass table. Casing of
+ * any piece is then a popcount over `upper` instead of a second scan.
+ *
+ * Comments, strings and preprocessor blobs are split into words the
+ * same way: one delimiter mask (CC_SPACE | CC_PUNCT) for the whole
+ * leaf, from a pshufb nibble lookup, then word spans by bit scans.
+ */
+
+#ifndef NSET_SEGMENT_H
+#define NSET_SEGMENT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "charclass.h"
+
+#define SEG_MAX_LEN   65536                 // Token lengths are uint16_t
+#define SEG_MAX_WORDS (SEG_MAX_LEN / 64)
+
+typedef struct {
+    uint64_t under[SEG_MAX_WORDS];
+    uint64_t upper[SEG_MAX_WORDS];
+    uint64_t lower[SEG_MAX_WORDS];
+    int len;
+} SegMasks;
+
+// ==========================================
+// BLOCK CLASSIFIERS
+// ==========================================
+// Each one fills bits [bit, bit + width) of word `w` for a full block.
+#if defined(__AVX2__)
+#define SEG_BLOCK 32
+static inline void seg_block(const uint8_t *p, SegMasks *m, int w, int bit) {
+    __m256i c = _mm256_loadu_si256((const __m256i *)p);
+    // Signed compares: bytes >= 0x80 are negative and fall outside every range
+    __m256i up = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('A' - 1)),
+                                  _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), c));
+    __m256i lo = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('a' - 1)),
+                                  _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), c));
+    __m256i us = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('_'));
+    m->upper[w] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(up) << bit;
+    m->lower[w] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(lo) << bit;
+    m->under[w] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(us) << bit;
+}
+#elif defined(__SSE2__)
+#define SEG_BLOCK 16
+static inline void seg_block(const uint8_t *p, SegMasks *m, int w, int bit) {
+    __m128i c = _mm_loadu_si128((const __m128i *)p);
+    __m128i up = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('A' - 1)),
+                               _mm_cmplt_epi8(c, _mm_set1_epi8('Z' + 1)));
+    __m128i lo = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('a' - 1)),
+                               _mm_cmplt_epi8(c, _mm_set1_epi8('z' + 1)));
+    __m128i us = _mm_cmpeq_epi8(c, _mm_set1_epi8('_'));
+    m->upper[w] |= (uint64_t)(uint16_t)_mm_movemask_epi8(up) << bit;
+    m->lower[w] |= (uint64_t)(uint16_t)_mm_movemask_epi8(lo) << bit;
+    m->under[w] |= (uint64_t)(uint16_t)_mm_movemask_epi8(us) << bit;
+}
+#else
+#define SEG_BLOCK 8
+static inline void seg_block(const uint8_t *p, SegMasks *m, int w, int bit) {
+    for (int k = 0; k < SEG_BLOCK; k++) {
+        uint64_t b = 1ull << (bit + k);
+        if (cc_is_upper(p[k])) m->upper[w] |= b;
+        if (cc_is_lower(p[k])) m->lower[w] |= b;
+        if (p[k] == '_') m->under[w] |= b;
+    }
+}
+#endif
+
+// Classifies s[0, len). Only the words covering len are touched.
+static inline void seg_classify(const uint8_t *s, int len, SegMasks *m) {
+    int words = (len + 63) / 64;
+    memset(m->under, 0, words * sizeof(uint64_t));
+    memset(m->upper, 0, words * sizeof(uint64_t));
+    memset(m->lower, 0, words * sizeof(uint64_t));
+    m->len = len;
+
+    int i = 0;
+    for (; i + SEG_BLOCK <= len; i += SEG_BLOCK) seg_block(s + i, m, i / 64, i % 64);
+    if (i < len) {
+        // Tail: classify a zero-padded copy so the loads stay in bounds
+        uint8_t tail[SEG_BLOCK] = {0};
+        memcpy(tail, s + i, len - i);
+        seg_block(tail, m, i / 64, i % 64);
+    }
+}
+
+// ==========================================
+// WORD SPLITTER
+// ==========================================
+// Delimiters are cc_is(c, CC_SPACE | CC_PUNCT). Per high nibble the set
+// of low nibbles is one of six patterns; a byte is a delimiter when the
+// pattern bit of its high nibble is set in the entry of its low nibble:
+//   0x0_: 9..D (\t..\r)    0x2_: all         0x3_: A..F
+//   0x4_, 0x6_: 0 (@ `)    0x5_: B..F        0x7_: B..E
+#if defined(__AVX2__) || defined(__SSSE3__)
+#define SEG_DELIM_HI 0x01, 0x00, 0x02, 0x04, 0x08, 0x10, 0x08, 0x20, 0, 0, 0, 0, 0, 0, 0, 0
+#define SEG_DELIM_LO 0x0A, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, \
+                     0x02, 0x03, 0x07, 0x37, 0x37, 0x37, 0x36, 0x16
+#endif
+
+#if defined(__AVX2__)
+#define SEG_DELIM_BLOCK 32
+static inline uint64_t seg_delim_block(const uint8_t *p) {
+    const __m256i hi_tab = _mm256_setr_epi8(SEG_DELIM_HI, SEG_DELIM_HI);
+    const __m256i lo_tab = _mm256_setr_epi8(SEG_DELIM_LO, SEG_DELIM_LO);
+    const __m256i nib = _mm256_set1_epi8(0x0F);
+    __m256i c = _mm256_loadu_si256((const __m256i *)p);
+    __m256i hi = _mm256_shuffle_epi8(hi_tab, _mm256_and_si256(_mm256_srli_epi16(c, 4), nib));
+    __m256i lo = _mm256_shuffle_epi8(lo_tab, _mm256_and_si256(c, nib));
+    __m256i hit = _mm256_cmpeq_epi8(_mm256_and_si256(hi, lo), _mm256_setzero_si256());
+    return ~(uint64_t)(uint32_t)_mm256_movemask_epi8(hit) & 0xFFFFFFFFull;
+}
+#elif defined(__SSSE3__)
+#define SEG_DELIM_BLOCK 16
+static inline uint64_t seg_delim_block(const uint8_t *p) {
+    const __m128i hi_tab = _mm_setr_epi8(SEG_DELIM_HI);
+    const __m128i lo_tab = _mm_setr_epi8(SEG_DELIM_LO);
+    const __m128i nib = _mm_set1_epi8(0x0F);
+    __m128i c = _mm_loadu_si128((const __m128i *)p);
+    __m128i hi = _mm_shuffle_epi8(hi_tab, _mm_and_si128(_mm_srli_epi16(c, 4), nib));
+    __m128i lo = _mm_shuffle_epi8(lo_tab, _mm_and_si128(c, nib));
+    __m128i hit = _mm_cmpeq_epi8(_mm_and_si128(hi, lo), _mm_setzero_si128());
+    return ~(uint64_t)(uint16_t)_mm_movemask_epi8(hit) & 0xFFFFull;
+}
+#else
+#define SEG_DELIM_BLOCK 8
+static inline uint64_t seg_delim_block(const uint8_t *p) {
+    uint64_t m = 0;
+    for (int k = 0; k < SEG_DELIM_BLOCK; k++) if (cc_is(p[k], CC_SPACE | CC_PUNCT)) m |= 1ull << k;
+    return m;
+}
+#endif
+
+// Fills delim[0, (len + 63) / 64) with the delimiter mask of s[0, len).
+// Bits past len are set, so a word never runs off the end.
+static inline void seg_delimiters(const uint8_t *s, int len, uint64_t *delim) {
+    int words = (len + 63) / 64;
+    memset(delim, 0, words * sizeof(uint64_t));
+    int i = 0;
+    for (; i + SEG_DELIM_BLOCK <= len; i += SEG_DELIM_BLOCK)
+        delim[i / 64] |= seg_delim_block(s + i) << (i % 64);
+    if (i < len) {
+        uint8_t tail[SEG_DELIM_BLOCK];
+        memset(tail, ' ', sizeof(tail));
+        memcpy(tail, s + i, len - i);
+        delim[i / 64] |= seg_delim_block(tail) << (i % 64);
+    }
+    if (len % 64) delim[len / 64] |= ~0ull << (len % 64);
+}
+
+// Next word at or after *pos: returns false when there is none, else
+// sets *start and *end and moves *pos past the word.
+static inline bool seg_next_word(const uint64_t *delim, int len, int *pos, int *start, int *end) {
+    int i = *pos;
+    // Skip delimiters: first clear bit
+    for (;;) {
+        if (i >= len) return false;
+        uint64_t m = ~delim[i >> 6] & (~0ull << (i & 63));
+        if (m) { i = (i & ~63) + __builtin_ctzll(m); break; }
+        i = (i & ~63) + 64;
+    }
+    *start = i;
+    // Then the word: up to the first set bit, or len
+    while (i < len) {
+        uint64_t m = delim[i >> 6] & (~0ull << (i & 63));
+        if (m) { i = (i & ~63) + __builtin_ctzll(m); break; }
+        i = (i & ~63) + 64;
+    }
+    if (i > len) i = len;
+    *end = i;
+    *pos = i;
+    return true;
+}
+
+// ==========================================
+// QUERIES
+// ==========================================
+static inline bool seg_bit(const uint64_t *words, int i) {
+    return (words[i >> 6] >> (i & 63)) & 1;
+}
+
+// Lower followed by upper: the split goes after byte i.
+static inline bool seg_camel(const SegMasks *m, int i) {
+    return i + 1 < m->len && seg_bit(m->lower, i) && seg_bit(m->upper, i + 1);
+}
+
+static inline int seg_count(const uint64_t *words, int from, int to) {
+    int n = 0;
+    while (from < to) {
+        int w = from >> 6, lo = from & 63;
+        int hi = (to - (w << 6) < 64) ? to - (w << 6) : 64;
+        uint64_t bits = words[w] >> lo;
+        if (hi - lo < 64) bits &= (1ull << (hi - lo)) - 1;
+        n += __builtin_popcountll(bits);
+        from = (w << 6) + hi;
+    }
+    return n;
+}
+
+// Casing class of a piece: 0 lower, 1 Capitalized, 2 UPPER, 3 mixed.
+static inline uint8_t seg_casing(const SegMasks *m, int start, int len) {
+    int caps = seg_count(m->upper, start, start + len);
+    if (caps == 0) return 0;
+    if (caps == len) return 2;
+    if (caps == 1 && seg_bit(m->upper, start)) return 1;
+    return 3;
+}
+
+#endif
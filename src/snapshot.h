@@ -0,0 +1,132 @@
+/* * NSET v6.0 - Entropy Model Snapshots
+ * -------------------------------------------------------
+ * On-disk format (version 1), native little-endian:
+ *
+ *   [Header 64 bytes] magic "NSETMDL\0", sizes, corpus stats, checksums
+ *   [Model  ...     ] the EntropyModel image, byte for byte
+ *
+ * The payload is the struct itself, so a snapshot is used straight
+ * from a read-only MAP_SHARED mapping: no parse step, and every
+ * process tokenizing against the same file shares its page cache.
+ * model_size must equal sizeof(EntropyModel); any layout change to the
+ * model bumps NSET_MODEL_VERSION. Saves go through a tmp file + rename,
+ * so readers never observe a half-written snapshot.
+ */
+
+#ifndef NSET_SNAPSHOT_H
+#define NSET_SNAPSHOT_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "entropy.h"
+
+#define NSET_MODEL_MAGIC   "NSETMDL"
+#define NSET_MODEL_VERSION 1
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t model_offset;
+    uint64_t model_size;      // sizeof(EntropyModel) of the writer
+    uint64_t trained_files;   // Corpus the counts came from (informational)
+    uint64_t trained_bytes;
+    uint32_t body_checksum;   // FNV-1a over the model image
+    uint32_t header_checksum; // FNV-1a over all preceding header bytes
+    uint8_t  reserved[8];
+} NSET_ModelHeader;
+
+_Static_assert(sizeof(NSET_ModelHeader) == 64, "model header must stay 64 bytes");
+
+typedef struct {
+    const uint8_t *map;
+    size_t map_size;
+    const EntropyModel *model;  // Points into the mapping
+    NSET_ModelHeader header;
+} ModelSnapshot;
+
+static inline uint32_t snapshot_checksum(const void *data, size_t len, uint32_t h) {
+    const uint8_t *p = data;
+    for (size_t i = 0; i < len; i++) { h ^= p[i]; h *= 0x01000193; }
+    return h;
+}
+
+static inline bool model_snapshot_save(const char *path, const EntropyModel *m,
+                                       uint64_t trained_files, uint64_t trained_bytes) {
+    char tmp_path[4096];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *out = fopen(tmp_path, "wb");
+    if (!out) return false;
+
+    NSET_ModelHeader h = {0};
+    memcpy(h.magic, NSET_MODEL_MAGIC, sizeof(NSET_MODEL_MAGIC));
+    h.version = NSET_MODEL_VERSION;
+    h.header_size = sizeof(h);
+    h.model_offset = sizeof(h);
+    h.model_size = sizeof(EntropyModel);
+    h.trained_files = trained_files;
+    h.trained_bytes = trained_bytes;
+    h.body_checksum = snapshot_checksum(m, sizeof(EntropyModel), 0x811c9dc5);
+    h.header_checksum = snapshot_checksum(&h, offsetof(NSET_ModelHeader, header_checksum), 0x811c9dc5);
+
+    bool ok = fwrite(&h, sizeof(h), 1, out) == 1 && fwrite(m, sizeof(EntropyModel), 1, out) == 1;
+    ok = (fflush(out) == 0) && (fsync(fileno(out)) == 0) && ok;
+    ok = (fclose(out) == 0) && ok;
+    if (!ok || rename(tmp_path, path) != 0) { remove(tmp_path); return false; }
+    return true;
+}
+
+// Maps a snapshot read-only. On failure prints why and returns false.
+static inline bool model_snapshot_map(const char *path, ModelSnapshot *s) {
+    memset(s, 0, sizeof(*s));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) { fprintf(stderr, "Error opening model %s: %s\n", path, strerror(errno)); return false; }
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || (size_t)sb.st_size < sizeof(NSET_ModelHeader)) {
+        fprintf(stderr, "Error: %s is not an NSET model\n", path);
+        close(fd);
+        return false;
+    }
+    const uint8_t *base = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) { fprintf(stderr, "Error mapping model %s: %s\n", path, strerror(errno)); return false; }
+
+    const NSET_ModelHeader *h = (const NSET_ModelHeader *)base;
+    const char *why = NULL;
+    if (memcmp(h->magic, NSET_MODEL_MAGIC, sizeof(NSET_MODEL_MAGIC)) != 0) why = "not an NSET model";
+    else if (h->header_checksum != snapshot_checksum(h, offsetof(NSET_ModelHeader, header_checksum), 0x811c9dc5))
+        why = "header checksum mismatch";
+    else if (h->version != NSET_MODEL_VERSION || h->model_size != sizeof(EntropyModel))
+        why = "model version/layout differs from this build";
+    else if (h->model_offset % 8 != 0 || h->model_offset + h->model_size > (uint64_t)sb.st_size)
+        why = "truncated";
+    else if (h->body_checksum != snapshot_checksum(base + h->model_offset, h->model_size, 0x811c9dc5))
+        why = "body checksum mismatch";
+    if (why) {
+        fprintf(stderr, "Error: model %s: %s\n", path, why);
+        munmap((void *)base, sb.st_size);
+        return false;
+    }
+
+    s->map = base;
+    s->map_size = sb.st_size;
+    s->model = (const EntropyModel *)(base + h->model_offset);
+    s->header = *h;
+    return true;
+}
+
+static inline void model_snapshot_unmap(ModelSnapshot *s) {
+    if (s->map) munmap((void *)s->map, s->map_size);
+    memset(s, 0, sizeof(*s));
+}
+
+#endif
@@ -0,0 +1,237 @@
+/* * NSET v6.0 - Token Stream Output
+ * -------------------------------------------------------
+ * On-disk format (version 3), native little-endian:
+ *
+ *   [Header  64 B ] magic "NSETTOK\0", counts, offsets, checksums
+ *   [Files        ] NSET_StreamFile per input file, in input order
+ *   [Paths        ] the input paths, back to back, no terminators
+ *   [Records      ] record_size bytes each, 64-byte aligned
+ *
+ * The records are tokens in one of two encodings:
+ * - STREAM_PACKED: 8-byte packed tokens (pack.h), decoded front to
+ *   back per file; a file may hold more records than tokens (escapes)
+ * - STREAM_RECORDS: the in-memory NSET_Token array byte for byte, so a
+ *   reader maps the file and indexes tokens directly
+ * A file's records are one contiguous run [first_record, +record_count).
+ * Runs are placed in the order files finish, so with several workers
+ * they are not in input order; always go through the file table.
+ * Version 1 was STREAM_RECORDS only, with record_count unset; versions
+ * 1 and 2 kept one meta flag per absorbed symbol instead of the code.
+ *
+ * Every finished file is written with one pwrite() per buffer it
+ * holds, into a run reserved with an atomic add, so workers never wait
+ * on each other. The header and file table go last, into a tmp file that
+ * is renamed over the output: a crashed run never leaves a stream that
+ * looks complete.
+ */
+
+#ifndef NSET_STREAM_H
+#define NSET_STREAM_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define NSET_STREAM_MAGIC   "NSETTOK"
+#define NSET_STREAM_VERSION 3
+
+#define STREAM_RECORDS 0      // NSET_Token records
+#define STREAM_PACKED  1      // NSET_PackedToken words
+
+#define STREAM_FILE_FAILED 1  // NSET_StreamFile.flags: could not be read; no tokens
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint16_t record_size;     // Bytes per record
+    uint16_t encoding;        // STREAM_RECORDS or STREAM_PACKED
+    uint32_t file_count;
+    uint64_t token_count;
+    uint64_t files_offset;
+    uint64_t paths_offset;
+    uint64_t records_offset;
+    uint32_t files_checksum;  // FNV-1a over the file table
+    uint32_t header_checksum; // FNV-1a over all preceding header bytes
+} NSET_StreamHeader;
+
+typedef struct {
+    uint64_t first_record;    // Index into the record array
+    uint64_t token_count;
+    uint64_t source_size;     // Bytes of the source file
+    uint32_t path_offset;     // Relative to paths_offset
+    uint16_t path_len;
+    uint16_t flags;
+    uint32_t checksum;        // FNV-1a over the file's records
+    uint32_t record_count;
+} NSET_StreamFile;
+
+_Static_assert(sizeof(NSET_StreamHeader) == 64, "stream header must stay 64 bytes");
+_Static_assert(sizeof(NSET_StreamFile) == 40, "stream file entry must stay 40 bytes");
+
+typedef struct {
+    int fd;
+    char path[4096];
+    char tmp_path[4096];
+    uint16_t record_size;
+    uint16_t encoding;
+    NSET_StreamFile *files;
+    char *paths;
+    uint32_t n_files, cap_files;
+    uint32_t paths_size, cap_paths;
+    uint64_t records_offset;
+    atomic_uint_fast64_t next_record;
+    atomic_uint_fast64_t tokens;
+    atomic_int write_errno;   // First failed write, 0 if none
+} TokenStream;
+
+static inline uint32_t stream_checksum(const void *data, size_t len, uint32_t h) {
+    const uint8_t *p = data;
+    for (size_t i = 0; i < len; i++) { h ^= p[i]; h *= 0x01000193; }
+    return h;
+}
+
+// Adds the next input file to the table. All files come before stream_open().
+static inline void stream_add_file(TokenStream *s, const char *path, uint64_t source_size) {
+    if (s->n_files == s->cap_files) {
+        s->cap_files = s->cap_files ? s->cap_files * 2 : 64;
+        s->files = realloc(s->files, s->cap_files * sizeof(NSET_StreamFile));
+    }
+    size_t len = strlen(path);
+    if (len > UINT16_MAX) len = UINT16_MAX;
+    while (s->paths_size + len > s->cap_paths) {
+        s->cap_paths = s->cap_paths ? s->cap_paths * 2 : 4096;
+        s->paths = realloc(s->paths, s->cap_paths);
+    }
+    memcpy(s->paths + s->paths_size, path, len);
+    // Checksum of an empty run, for files that never write one
+    NSET_StreamFile f = { .source_size = source_size, .path_offset = s->paths_size, .path_len = len,
+                          .checksum = 0x811c9dc5 };
+    s->files[s->n_files++] = f;
+    s->paths_size += len;
+}
+
+// Creates the output (as a tmp file until stream_close). False on error, with errno set.
+static inline bool stream_open(TokenStream *s, const char *path, uint16_t encoding, uint16_t record_size) {
+    snprintf(s->path, sizeof(s->path), "%s", path);
+    snprintf(s->tmp_path, sizeof(s->tmp_path), "%s.tmp", path);
+    s->fd = open(s->tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (s->fd < 0) return false;
+    s->encoding = encoding;
+    s->record_size = record_size;
+    uint64_t end = sizeof(NSET_StreamHeader) + (uint64_t)s->n_files * sizeof(NSET_StreamFile) + s->paths_size;
+    s->records_offset = (end + 63) & ~(uint64_t)63;
+    atomic_init(&s->next_record, 0);
+    atomic_init(&s->tokens, 0);
+    atomic_init(&s->write_errno, 0);
+    return true;
+}
+
+static inline bool stream_pwrite(TokenStream *s, const void *data, size_t len, uint64_t pos) {
+    const uint8_t *p = data;
+    while (len > 0) {
+        ssize_t n = pwrite(s->fd, p, len, pos);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            int expected = 0;
+            atomic_compare_exchange_strong(&s->write_errno, &expected, n < 0 ? errno : EIO);
+            return false;
+        }
+        p += n; len -= n; pos += n;
+    }
+    return true;
+}
+
+typedef struct {
+    uint32_t file;
+    uint64_t pos;         // Next byte of the file's run
+    uint32_t checksum;
+} StreamRun;
+
+// Reserves the run of input file `file`: `records` records holding
+// `tokens` tokens. Thread-safe; each file once. The records follow with
+// stream_append, in order, in as many pieces as the caller holds them.
+static inline StreamRun stream_begin_file(TokenStream *s, uint32_t file, uint64_t tokens, uint32_t records) {
+    NSET_StreamFile *f = &s->files[file];
+    f->first_record = atomic_fetch_add(&s->next_record, records);
+    f->record_count = records;
+    f->token_count = tokens;
+    atomic_fetch_add(&s->tokens, tokens);
+    StreamRun r = { file, s->records_offset + f->first_record * s->record_size, 0x811c9dc5 };
+    return r;
+}
+
+// Grows the run of r->file by `records` records holding `tokens` tokens,
+// for input whose size is not known up front. The run stays contiguous
+// only while no other file is being written: a streamed input is the
+// only file of its run.
+static inline void stream_extend_file(TokenStream *s, StreamRun *r, uint64_t tokens, uint32_t records) {
+    NSET_StreamFile *f = &s->files[r->file];
+    atomic_fetch_add(&s->next_record, records);
+    atomic_fetch_add(&s->tokens, tokens);
+    f->record_count += records;
+    f->token_count += tokens;
+}
+
+static inline void stream_set_source_size(TokenStream *s, uint32_t file, uint64_t size) {
+    s->files[file].source_size = size;
+}
+
+static inline void stream_append(TokenStream *s, StreamRun *r, const void *records, uint64_t count) {
+    size_t bytes = count * s->record_size;
+    r->checksum = stream_checksum(records, bytes, r->checksum);
+    if (bytes > 0) stream_pwrite(s, records, bytes, r->pos);
+    r->pos += bytes;
+}
+
+static inline void stream_end_file(TokenStream *s, StreamRun *r) {
+    s->files[r->file].checksum = r->checksum;
+}
+
+static inline void stream_fail_file(TokenStream *s, uint32_t file) {
+    s->files[file].flags |= STREAM_FILE_FAILED;
+}
+
+// Writes the tables and publishes the stream. False on error, with errno set.
+static inline bool stream_close(TokenStream *s) {
+    NSET_StreamHeader h = {0};
+    memcpy(h.magic, NSET_STREAM_MAGIC, sizeof(NSET_STREAM_MAGIC));
+    h.version = NSET_STREAM_VERSION;
+    h.header_size = sizeof(h);
+    h.record_size = s->record_size;
+    h.encoding = s->encoding;
+    h.file_count = s->n_files;
+    h.token_count = atomic_load(&s->tokens);
+    h.files_offset = sizeof(h);
+    h.paths_offset = h.files_offset + (uint64_t)s->n_files * sizeof(NSET_StreamFile);
+    h.records_offset = s->records_offset;
+    h.files_checksum = stream_checksum(s->files, s->n_files * sizeof(NSET_StreamFile), 0x811c9dc5);
+    h.header_checksum = stream_checksum(&h, offsetof(NSET_StreamHeader, header_checksum), 0x811c9dc5);
+
+    bool ok = stream_pwrite(s, s->files, s->n_files * sizeof(NSET_StreamFile), h.files_offset) &&
+              stream_pwrite(s, s->paths, s->paths_size, h.paths_offset) &&
+              stream_pwrite(s, &h, sizeof(h), 0);
+    // An empty record array still has to reach records_offset
+    ok = ok && ftruncate(s->fd, s->records_offset + atomic_load(&s->next_record) * s->record_size) == 0;
+    ok = ok && atomic_load(&s->write_errno) == 0 && fsync(s->fd) == 0;
+    ok = (close(s->fd) == 0) && ok;
+    ok = ok && rename(s->tmp_path, s->path) == 0;
+    if (!ok) {
+        int err = atomic_load(&s->write_errno) ? atomic_load(&s->write_errno) : errno;
+        unlink(s->tmp_path);
+        errno = err;
+    }
+    s->fd = -1;
+    free(s->files); free(s->paths);
+    s->files = NULL; s->paths = NULL;
+    return ok;
+}
+
+#endif
@@ -0,0 +1,281 @@
+/* * NSET v6.0 - Parse Arena (tree-sitter allocator)
+ * -------------------------------------------------------
+ * Installed with ts_set_allocator(), so every allocation tree-sitter
+ * makes goes through here. While a worker has its arena open (one
+ * file: parser, tree, cursors), allocations come from that thread's
+ * arena:
+ * - sizes up to PA_MAX_SMALL round to a power-of-two class; a freed
+ *   block goes on its class free list and is handed out again
+ * - larger blocks are bumped, and only their memory is reused after
+ *   the reset (the last bumped block grows in place on realloc)
+ * - blocks over PA_MAX_BUMP (the big arrays a large file grows by
+ *   doubling) are owned heap blocks: realloc and free go to libc at
+ *   once, so doubling does not strand every old copy in a chunk
+ * - parse_arena_end() drops everything at once: no per-node frees
+ * Chunks are kept across files, so once the arena has grown to the
+ * largest file's working set a file costs no heap calls at all. The
+ * stats report when the last chunk was added.
+ *
+ * Every block carries a 16-byte header naming its class, so free()
+ * works for blocks from any arena and for the plain malloc()s made
+ * while no arena is open (e.g. during startup).
+ */
+
+#ifndef NSET_TSALLOC_H
+#define NSET_TSALLOC_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tree_sitter/api.h>
+
+#define PA_CHUNK_SIZE (1u << 20)
+#define PA_MIN_SHIFT  4                 // Smallest class: 16 bytes
+#define PA_CLASSES    8                 // 16 .. 2048
+#define PA_MAX_SMALL  (1u << (PA_MIN_SHIFT + PA_CLASSES - 1))
+#define PA_MAX_BUMP   (PA_CHUNK_SIZE / 4)
+#define PA_OWNED      0xFD              // Heap block tracked by the arena
+#define PA_LARGE      0xFE              // Bumped block, no free list
+#define PA_HEAP       0xFF              // Plain malloc (no arena open)
+
+typedef struct {
+    uint64_t size;        // Usable bytes
+    uint32_t cls;         // Class index, PA_OWNED, PA_LARGE or PA_HEAP
+    uint32_t owned;       // PA_OWNED: index in ParseArena.owned
+} PA_Header;
+
+_Static_assert(sizeof(PA_Header) == 16, "block header keeps 16-byte alignment");
+
+typedef struct PA_Chunk {
+    struct PA_Chunk *next;
+    size_t size;          // Usable bytes after this header
+    size_t pad;
+} PA_Chunk;
+
+typedef struct {
+    PA_Chunk *first;      // Kept across resets
+    PA_Chunk *current;
+    size_t used;          // Bump offset in `current`
+    PA_Header *last;      // Most recent bumped block
+    PA_Header *free_list[PA_CLASSES];
+    PA_Header **owned;    // Live PA_OWNED blocks, freed at the reset
+    uint32_t n_owned, cap_owned;
+    size_t file_bytes;    // Bumped and owned bytes this file
+    // Stats
+    uint64_t files;
+    uint64_t allocs, reused, frees;
+    uint64_t owned_allocs;
+    uint64_t chunk_mallocs;
+    uint64_t last_grow_file;   // 1-based file number that last added a chunk
+    size_t reserved_bytes;
+    size_t peak_bytes;         // Largest per-file footprint
+} ParseArena;
+
+static __thread ParseArena *parse_arena_current = NULL;
+static atomic_uint_fast64_t parse_arena_heap_allocs;
+
+static inline void *pa_block(PA_Header *h) { return h + 1; }
+static inline PA_Header *pa_header(void *p) { return (PA_Header *)p - 1; }
+
+static inline int pa_class(size_t size) {
+    int cls = 0;
+    while (((size_t)1 << (PA_MIN_SHIFT + cls)) < size) cls++;
+    return cls;
+}
+
+// Bumps `bytes` (header included) from the chunk list, adding a chunk if needed.
+static inline PA_Header *pa_bump(ParseArena *a, size_t bytes) {
+    while (a->current && a->used + bytes > a->current->size) {
+        a->current = a->current->next;
+        a->used = 0;
+    }
+    if (!a->current) {
+        size_t size = bytes > PA_CHUNK_SIZE ? bytes : PA_CHUNK_SIZE;
+        PA_Chunk *c = malloc(sizeof(PA_Chunk) + size);
+        if (!c) return NULL;
+        c->size = size;
+        c->next = NULL;
+        // Append, so the next reset walks the chunks in the order they filled
+        PA_Chunk **tail = &a->first;
+        while (*tail) tail = &(*tail)->next;
+        *tail = c;
+        a->current = c;
+        a->used = 0;
+        a->chunk_mallocs++;
+        a->reserved_bytes += size;
+        a->last_grow_file = a->files + 1;
+    }
+    PA_Header *h = (PA_Header *)((uint8_t *)(a->current + 1) + a->used);
+    a->last = h;
+    a->used += bytes;
+    a->file_bytes += bytes;
+    return h;
+}
+
+static inline void *pa_alloc(ParseArena *a, size_t size) {
+    a->allocs++;
+    PA_Header *h;
+    if (size <= PA_MAX_SMALL) {
+        int cls = pa_class(size);
+        if ((h = a->free_list[cls]) != NULL) {
+            a->free_list[cls] = *(PA_Header **)pa_block(h);
+            a->reused++;
+            return pa_block(h);
+        }
+        size_t block = (size_t)1 << (PA_MIN_SHIFT + cls);
+        if (!(h = pa_bump(a, sizeof(PA_Header) + block))) return NULL;
+        h->size = block;
+        h->cls = cls;
+    } else if (size > PA_MAX_BUMP) {
+        if (a->n_owned == a->cap_owned) {
+            a->cap_owned = a->cap_owned ? a->cap_owned * 2 : 16;
+            a->owned = realloc(a->owned, a->cap_owned * sizeof(PA_Header *));
+        }
+        if (!(h = malloc(sizeof(PA_Header) + size))) return NULL;
+        h->size = size;
+        h->cls = PA_OWNED;
+        h->owned = a->n_owned;
+        a->owned[a->n_owned++] = h;
+        a->owned_allocs++;
+        a->file_bytes += size;
+    } else {
+        size_t block = (size + 15) & ~(size_t)15;
+        if (!(h = pa_bump(a, sizeof(PA_Header) + block))) return NULL;
+        h->size = block;
+        h->cls = PA_LARGE;
+    }
+    return pa_block(h);
+}
+
+// ==========================================
+// TREE-SITTER CALLBACKS
+// ==========================================
+static void *pa_malloc(size_t size) {
+    ParseArena *a = parse_arena_current;
+    if (a) return pa_alloc(a, size);
+    atomic_fetch_add_explicit(&parse_arena_heap_allocs, 1, memory_order_relaxed);
+    PA_Header *h = malloc(sizeof(PA_Header) + size);
+    if (!h) return NULL;
+    h->size = size;
+    h->cls = PA_HEAP;
+    return pa_block(h);
+}
+
+static void *pa_calloc(size_t n, size_t size) {
+    size_t bytes = n * size;
+    if (size && bytes / size != n) return NULL;
+    void *p = pa_malloc(bytes);
+    if (p) memset(p, 0, bytes);
+    return p;
+}
+
+static inline void pa_unown(ParseArena *a, PA_Header *h) {
+    PA_Header *moved = a->owned[--a->n_owned];
+    a->owned[h->owned] = moved;
+    moved->owned = h->owned;
+}
+
+static void pa_free(void *p) {
+    if (!p) return;
+    PA_Header *h = pa_header(p);
+    if (h->cls == PA_HEAP) { free(h); return; }
+    ParseArena *a = parse_arena_current;
+    // Arena blocks are only recycled by the arena that is open; otherwise
+    // they go with the next reset
+    if (!a) return;
+    a->frees++;
+    if (h->cls == PA_OWNED) {
+        pa_unown(a, h);
+        free(h);
+    } else if (h->cls < PA_CLASSES) {
+        *(PA_Header **)p = a->free_list[h->cls];
+        a->free_list[h->cls] = h;
+    }
+}
+
+static void *pa_realloc(void *p, size_t size) {
+    if (!p) return pa_malloc(size);
+    PA_Header *h = pa_header(p);
+    if (h->cls == PA_HEAP) {
+        PA_Header *n = realloc(h, sizeof(PA_Header) + size);
+        if (!n) return NULL;
+        n->size = size;
+        return pa_block(n);
+    }
+    if (size <= h->size) return p;
+    ParseArena *a = parse_arena_current;
+    if (a && h->cls == PA_OWNED) {
+        PA_Header *n = realloc(h, sizeof(PA_Header) + size);
+        if (!n) return NULL;
+        a->file_bytes += size - n->size;
+        n->size = size;
+        a->owned[n->owned] = n;
+        return pa_block(n);
+    }
+    // A large block that is the newest one bumped can grow where it is
+    if (a && h == a->last && h->cls == PA_LARGE) {
+        size_t grow = ((size + 15) & ~(size_t)15) - h->size;
+        if (a->used + grow <= a->current->size) {
+            a->used += grow;
+            a->file_bytes += grow;
+            h->size += grow;
+            return p;
+        }
+    }
+    void *n = pa_malloc(size);
+    if (!n) return NULL;
+    memcpy(n, p, h->size);
+    pa_free(p);
+    return n;
+}
+
+// ==========================================
+// LIFECYCLE
+// ==========================================
+static inline void parse_arena_install() {
+    ts_set_allocator(pa_malloc, pa_calloc, pa_realloc, pa_free);
+}
+
+// Routes this thread's tree-sitter allocations to `a` until parse_arena_end.
+static inline void parse_arena_begin(ParseArena *a) {
+    a->current = a->first;
+    a->used = 0;
+    a->last = NULL;
+    a->file_bytes = 0;
+    memset(a->free_list, 0, sizeof(a->free_list));
+    parse_arena_current = a;
+}
+
+// Releases everything allocated since parse_arena_begin, all at once.
+// Nothing from this file may be used (or freed) afterwards.
+static inline void parse_arena_end(ParseArena *a) {
+    for (uint32_t i = 0; i < a->n_owned; i++) free(a->owned[i]);
+    a->n_owned = 0;
+    if (a->file_bytes > a->peak_bytes) a->peak_bytes = a->file_bytes;
+    a->files++;
+    parse_arena_current = NULL;
+}
+
+static inline void parse_arena_free(ParseArena *a) {
+    PA_Chunk *c = a->first;
+    while (c) { PA_Chunk *next = c->next; free(c); c = next; }
+    for (uint32_t i = 0; i < a->n_owned; i++) free(a->owned[i]);
+    free(a->owned);
+    memset(a, 0, sizeof(*a));
+}
+
+// `total` sums the workers' stats; last_grow_file is the latest of theirs.
+static inline void parse_arena_report(const ParseArena *total) {
+    if (total->files == 0) return;
+    printf(">> Parse arena: %lu files, %lu allocs (%.1f%% recycled, %lu big blocks), peak %.1f KB/file, "
+           "%.1f MB reserved in %lu chunks (last added on file %lu of a worker), %lu heap allocs outside.\n",
+           (unsigned long)total->files, (unsigned long)total->allocs,
+           total->allocs ? 100.0 * total->reused / total->allocs : 0.0, (unsigned long)total->owned_allocs,
+           total->peak_bytes / 1024.0, total->reserved_bytes / (1024.0 * 1024.0),
+           (unsigned long)total->chunk_mallocs, (unsigned long)total->last_grow_file,
+           (unsigned long)atomic_load(&parse_arena_heap_allocs));
+}
+
+#endif
@@ -62,7 +62,7 @@ def analyze_density(vocab_file, corpus_size):
         return
 
     vocab_size_bytes = os.path.getsize(vocab_file)
-    # Estimate count based on file size (approx 5 bytes overhead + avg len 6) ~ 11 bytes per token
+    # Estimate count based on file size (approx 6 bytes overhead + avg len 6 + index) ~ 20 bytes per token
     # Better to read it exactly if fast enough, but estimation works for quick stats
     
     print(f"\n[Comparison]")
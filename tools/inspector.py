@@ -4,30 +4,67 @@ import sys
 import argparse
 from collections import Counter
 
+VOCAB_MAGIC = b"NSETVOC\0"
+# magic, version, header_size, entry_count, records_offset, records_bytes,
+# index_offset, index_slots, body_checksum, header_checksum
+HEADER_FMT = "<8sIIQQQQQII"
+HEADER_SIZE = struct.calcsize(HEADER_FMT)
+
+def fnv1a(data, h=0x811c9dc5):
+    for b in data:
+        h = ((h ^ b) * 0x01000193) & 0xFFFFFFFF
+    return h
+
+def iter_records(data, pos, end, legacy):
+    """Yields (id, bytes) for each complete record in data[pos:end]."""
+    hdr = 5 if legacy else 6
+    while pos + hdr <= end:
+        token_id = struct.unpack_from("<I", data, pos)[0]
+        word_len = data[pos + 4] if legacy else struct.unpack_from("<H", data, pos + 4)[0]
+        if token_id == 0 or pos + hdr + word_len > end:
+            break
+        yield token_id, data[pos + hdr:pos + hdr + word_len]
+        pos += hdr + word_len
+    if pos < end:
+        print(f"[!] Torn record: {end - pos} trailing bytes ignored.")
+
 def read_registry(filename):
-    """Generates tokens from the binary registry file."""
+    """Generates tokens from the binary registry file (v2 indexed or legacy v1)."""
     if not os.path.exists(filename):
         print(f"Error: Registry file '{filename}' not found.")
         return
 
     with open(filename, "rb") as f:
-        while True:
-            # Format: [ID: 4 bytes][Len: 1 byte][Text: Len bytes]
-            id_bytes = f.read(4)
-            if not id_bytes: break
-            
-            token_id = struct.unpack("I", id_bytes)[0]
-            len_bytes = f.read(1)
-            if not len_bytes: break
-            
-            word_len = struct.unpack("B", len_bytes)[0]
-            word_bytes = f.read(word_len)
-            
+        data = f.read()
+
+    if data[:8] == VOCAB_MAGIC and len(data) >= HEADER_SIZE:
+        (_, version, _, entries, rec_off, rec_bytes,
+         idx_off, slots, body_sum, head_sum) = struct.unpack_from(HEADER_FMT, data)
+        if fnv1a(data[:HEADER_SIZE - 4]) != head_sum:
+            print("[!] Header checksum mismatch.")
+            return
+        body = fnv1a(data[rec_off:rec_off + rec_bytes])
+        body = fnv1a(data[idx_off:idx_off + slots * 4], body)
+        status = "ok" if body == body_sum else "MISMATCH"
+        print(f"    Format v{version}: {entries:,} indexed entries, {slots:,} slots, checksum {status}")
+        records = [(rec_off, rec_off + rec_bytes), (idx_off + slots * 4, len(data))]
+        legacy = False
+    else:
+        print("    Format v1 (legacy stream)")
+        records = [(0, len(data))]
+        legacy = True
+
+    seen = set()
+    for start, end in records:
+        for token_id, word_bytes in iter_records(data, start, end, legacy):
+            if token_id in seen:
+                continue
+            seen.add(token_id)
             try:
                 word = word_bytes.decode("utf-8")
             except UnicodeDecodeError:
                 word = f"<BINARY_DATA_{word_bytes.hex()}>"
-                
+
             yield token_id, word
 
 def print_histogram(data, label="Length", buckets=10):
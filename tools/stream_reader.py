@@ -0,0 +1,185 @@
+import mmap
+import os
+import re
+import struct
+import sys
+import argparse
+
+from inspector import fnv1a, read_registry
+
+STREAM_MAGIC = b"NSETTOK\0"
+# magic, version, header_size, record_size, encoding, file_count, token_count,
+# files_offset, paths_offset, records_offset, files_checksum, header_checksum
+# (version 1 had a u32 token_size in place of record_size + encoding, which
+# reads the same: encoding 0)
+HEADER_FMT = "<8sIIHHIQQQQII"
+HEADER_SIZE = struct.calcsize(HEADER_FMT)
+# first_record, token_count, source_size, path_offset, path_len, flags, checksum,
+# record_count (0 in version 1, where it equals token_count)
+FILE_FMT = "<QQQIHHII"
+FILE_SIZE = struct.calcsize(FILE_FMT)
+FILE_FAILED = 1
+
+ENC_RECORDS, ENC_PACKED = 0, 1
+# NSET_Token: root_id u32, offset u32, length u16, meta u16
+TOKEN_FMT = "<IIHH"
+TOKEN_SIZE = struct.calcsize(TOKEN_FMT)
+# NSET_PackedToken (pack.h): root_id 0..31, meta 32..47, length 48..55, gap 56..63;
+# a gap of PACK_ESCAPE is followed by a word holding offset 0..31, length 32..47
+PACKED_SIZE = 8
+PACK_ESCAPE = 0xFF
+RECORD_SIZES = {ENC_RECORDS: TOKEN_SIZE, ENC_PACKED: PACKED_SIZE}
+META_FIELDS = [  # (name, first bit, width), low bits first
+    ("type", 0, 3), ("casing", 3, 2), ("pre_space", 5, 1), ("pre_break", 6, 1),
+    ("has_joiner", 7, 1), ("depth", 8, 3), ("absorbed", 11, 4),
+]
+# Symbol folded into the token, by NSET_Meta.absorbed (ABSORB_* in arena.h)
+ABSORBED = [None, ";", ",", "(", ")", "*", "{", "}", "[", "]", ".", "->"]
+# Versions 1 and 2: one flag bit per symbol instead of the code
+LEGACY_ABSORB = [(11, 1), (12, 2), (13, 3), (14, 5), (15, 4)]  # (bit, code)
+RESERVED_IDS = 256
+
+def unpack_meta(meta, version=3):
+    fields = {name: (meta >> bit) & ((1 << width) - 1) for name, bit, width in META_FIELDS}
+    if version < 3:
+        fields["absorbed"] = next((code for bit, code in LEGACY_ABSORB if (meta >> bit) & 1), 0)
+    return fields
+
+RESERVED_HEADER = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "src", "reserved.h")
+
+def load_reserved(header=RESERVED_HEADER):
+    """Id -> text of the reserved tokens, read from the table in reserved.h."""
+    if not os.path.exists(header):
+        return {}
+    with open(header) as f:
+        text = f.read()
+    body = text[text.index("RESERVED_TOKENS[]"):]
+    body = body[body.index("{") + 1:body.index("};")]
+    body = re.sub(r"//[^\n]*", "", body)
+    names = re.findall(r'NULL|"((?:[^"\\]|\\.)*)"', body)
+    return {i: n for i, n in enumerate(names) if i > 0}
+
+class TokenStream:
+    """A mapped token stream. Record runs are memoryviews into the mapping (no copy)."""
+
+    def __init__(self, filename):
+        with open(filename, "rb") as f:
+            self.map = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        data = self.map
+        if len(data) < HEADER_SIZE or data[:8] != STREAM_MAGIC:
+            raise ValueError(f"{filename} is not an NSET token stream")
+        (_, self.version, _, self.record_size, self.encoding, self.file_count, self.token_count,
+         self.files_offset, self.paths_offset, self.records_offset,
+         files_sum, head_sum) = struct.unpack_from(HEADER_FMT, data)
+        if fnv1a(data[:HEADER_SIZE - 4]) != head_sum:
+            raise ValueError("header checksum mismatch")
+        if RECORD_SIZES.get(self.encoding) != self.record_size:
+            raise ValueError(f"unknown encoding {self.encoding} with {self.record_size}-byte records")
+        table = data[self.files_offset:self.files_offset + self.file_count * FILE_SIZE]
+        if fnv1a(table) != files_sum:
+            raise ValueError("file table checksum mismatch")
+        self.view = memoryview(data)
+
+    def files(self):
+        """Yields (path, first_record, record_count, token_count, source_size, failed, checksum) in input order."""
+        for i in range(self.file_count):
+            first, count, size, path_off, path_len, flags, checksum, records = struct.unpack_from(
+                FILE_FMT, self.map, self.files_offset + i * FILE_SIZE)
+            if self.version < 2:
+                records = count
+            start = self.paths_offset + path_off
+            path = bytes(self.map[start:start + path_len]).decode("utf-8", "replace")
+            yield path, first, records, count, size, bool(flags & FILE_FAILED), checksum
+
+    def records(self, first, count):
+        """Raw records of a run; numpy.frombuffer() can take this directly."""
+        start = self.records_offset + first * self.record_size
+        return self.view[start:start + count * self.record_size]
+
+    def iter_tokens(self, first, count):
+        """Decodes a file's run (first_record, record_count) to (root_id, offset, length, meta)."""
+        run = self.records(first, count)
+        if self.encoding == ENC_RECORDS:
+            for root_id, offset, length, meta in struct.iter_unpack(TOKEN_FMT, run):
+                yield root_id, offset, length, unpack_meta(meta, self.version)
+            return
+        words = iter(struct.iter_unpack("<Q", run))
+        end = 0
+        for (word,) in words:
+            gap = word >> 56
+            if gap != PACK_ESCAPE:
+                offset, length = end + gap, (word >> 48) & 0xFF
+            else:
+                (ext,) = next(words)
+                offset, length = ext & 0xFFFFFFFF, (ext >> 32) & 0xFFFF
+            end = offset + length
+            yield word & 0xFFFFFFFF, offset, length, unpack_meta((word >> 32) & 0xFFFF, self.version)
+
+def summarize(stream, verify):
+    encoding = "packed" if stream.encoding == ENC_PACKED else "records"
+    print(f"    Format v{stream.version} ({encoding}, {stream.record_size} B/record): "
+          f"{stream.file_count:,} files, {stream.token_count:,} tokens")
+    bad = failed = 0
+    for path, first, records, count, size, is_failed, checksum in stream.files():
+        failed += is_failed
+        if verify and fnv1a(stream.records(first, records)) != checksum:
+            bad += 1
+            print(f"[!] Checksum mismatch: {path}")
+    if failed:
+        print(f"[!] {failed} files failed to tokenize.")
+    if verify:
+        print("[+] All token runs verified." if bad == 0 else f"[!] {bad} token runs corrupt.")
+
+def compare(stream, stream_file, other_file):
+    """Token-by-token comparison with another stream, file by file (any encoding, any -j)."""
+    other = TokenStream(other_file)
+    theirs = {path: (first, records) for path, first, records, *_ in other.files()}
+    differ = 0
+    for path, first, records, count, *_ in stream.files():
+        if path not in theirs:
+            print(f"[!] Only in {stream_file}: {path}")
+            differ += 1
+            continue
+        if list(stream.iter_tokens(first, records)) != list(other.iter_tokens(*theirs.pop(path))):
+            print(f"[!] Tokens differ: {path}")
+            differ += 1
+    for path in theirs:
+        print(f"[!] Only in {other_file}: {path}")
+        differ += 1
+    print("[+] Same tokens in every file." if differ == 0 else f"[!] {differ} files differ.")
+    return differ == 0
+
+def dump(stream, which, limit, vocab_file):
+    words = load_reserved()
+    words.update(read_registry(vocab_file) or [])
+    for path, first, records, count, size, failed, _ in stream.files():
+        if which not in path:
+            continue
+        print(f"\n--- {path} ({count} tokens) ---")
+        for n, (root_id, offset, length, meta) in enumerate(stream.iter_tokens(first, records)):
+            if n >= limit:
+                print(f"... {count - limit} more")
+                break
+            kind = "R" if root_id < RESERVED_IDS else " "
+            absorbed = ABSORBED[meta["absorbed"]] if meta["absorbed"] < len(ABSORBED) else "?"
+            print(f"{offset:>8} {kind} {root_id:>10}  {words.get(root_id, '?')!r:<24} {absorbed or ''}")
+        return
+    print(f"[!] No file matching '{which}'.")
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="NSET Token Stream Reader")
+    parser.add_argument("stream", help="Token stream written with nset -o")
+    parser.add_argument("--verify", action="store_true", help="Check every token run's checksum")
+    parser.add_argument("--compare", metavar="OTHER", help="Check that another stream holds the same tokens per file")
+    parser.add_argument("--dump", metavar="PATH", help="Print the tokens of the first file whose path contains PATH")
+    parser.add_argument("--limit", type=int, default=40, help="Tokens to print with --dump")
+    parser.add_argument("--vocab", default="nset_vocab.bin", help="Registry used to decode ids")
+    args = parser.parse_args()
+
+    print(f"[*] Reading NSET Token Stream: {args.stream}")
+    stream = TokenStream(args.stream)
+    summarize(stream, args.verify)
+    if args.compare and not compare(stream, args.stream, args.compare):
+        sys.exit(1)
+    if args.dump:
+        dump(stream, args.dump, args.limit, args.vocab)